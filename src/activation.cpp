@@ -0,0 +1,180 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <cmath>
+#include <limits>
+#include "cnn.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+
+// The element-wise Ops on tensors, built once per ISA level like the other
+// kernels (see Isa).
+namespace
+{
+    void relu(const Tensor &input,
+              Tensor &output)
+    {
+        output.create(input.channels(), input.rows(), input.cols());
+        const int n = input.rows() * static_cast<int>(input.rowStep());
+        const simd::v8f _zero = simd::zero();
+        for (int b = 0; b < input.blocks(); b++)
+        {
+            const float *src = input.ptr(b);
+            float *dst       = output.ptr(b);
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+                simd::store(dst + i, simd::max(simd::load(src + i), _zero));
+            if (i < n)
+                simd::storePartial(dst + i, simd::max(simd::loadPartial(src + i, n - i), _zero), n - i);
+        }
+    }
+
+    void softmax(const Tensor &input,
+                 Tensor &output,
+                 const int head)
+    {
+        const int channels = input.channels();
+        const int lanes    = input.lanes();
+        const int pixels   = input.rows() * input.cols();
+
+        // Two classes: p0 = sigmoid(l0 - l1), eight interleaved pixels at a time.
+        if (channels == 2 && head != CNNHead::SOFTMAX)
+        {
+            const bool logit = (head == CNNHead::LOGIT);
+            const float *src = input.ptr();
+            output.create(1, input.rows(), input.cols());
+            float *dst = output.ptr();
+            const simd::v8f _one = simd::set1(1.f);
+            int p = 0;
+            for (; p + 8 <= pixels; p += 8)
+            {
+                simd::v8f l0, l1;
+                simd::deinterleave(simd::load(src + 2 * p), simd::load(src + 2 * p + 8), l0, l1);
+                const simd::v8f d = simd::sub(l0, l1);
+                simd::store(dst + p, logit ? d : simd::div(_one, simd::add(_one, simd::exp(simd::sub(l1, l0)))));
+            }
+            for (; p < pixels; p++)
+            {
+                const float d = src[2 * p] - src[2 * p + 1];
+                dst[p] = logit ? d : 1.f / (1.f + std::exp(-d));
+            }
+            return;
+        }
+
+        // One class, the logit difference of a head folded by Graph::foldHead.
+        if (channels == 1 && head != CNNHead::SOFTMAX)
+        {
+            const bool logit = (head == CNNHead::LOGIT);
+            const float *src = input.ptr();
+            output.create(1, input.rows(), input.cols());
+            float *dst = output.ptr();
+            const simd::v8f _one = simd::set1(1.f);
+            int p = 0;
+            for (; p + 8 <= pixels; p += 8)
+            {
+                const simd::v8f d = simd::load(src + p);
+                simd::store(dst + p, logit ? d : simd::div(_one, simd::add(_one, simd::exp(simd::sub(simd::zero(), d)))));
+            }
+            for (; p < pixels; p++)
+                dst[p] = logit ? src[p] : 1.f / (1.f + std::exp(-src[p]));
+            return;
+        }
+
+        // Channel vectors per pixel. The unused lanes of the last block are zero
+        // in the input; they get the lowest float for the max and are zeroed
+        // again after the exp.
+        const int blocks = input.blocks();
+        const int last   = channels - (blocks - 1) * Tensor::BLOCK;
+        float _valid[Tensor::BLOCK], _pad[Tensor::BLOCK];
+        for (int l = 0; l < Tensor::BLOCK; l++)
+        {
+            _valid[l] = (l < last) ? 1.f : 0.f;
+            _pad[l]   = (l < last) ? 0.f : std::numeric_limits<float>::lowest();
+        }
+        const simd::v8f valid = simd::load(_valid);
+        const simd::v8f pad   = simd::load(_pad);
+
+        output.create(channels, input.rows(), input.cols());
+        for (int p = 0; p < pixels; p++)
+        {
+            simd::v8f m = simd::set1(std::numeric_limits<float>::lowest());
+            for (int b = 0; b < blocks; b++)
+            {
+                const float *src = input.ptr(b) + p * lanes;
+                const simd::v8f v = (lanes == Tensor::BLOCK) ? simd::load(src) : simd::loadPartial(src, lanes);
+                m = simd::max(m, (b == blocks - 1) ? simd::add(v, pad) : v);
+            }
+            const simd::v8f _max = simd::set1(simd::hmax(m));
+
+            simd::v8f s = simd::zero();
+            for (int b = 0; b < blocks; b++)
+            {
+                const float *src = input.ptr(b) + p * lanes;
+                const simd::v8f v = (lanes == Tensor::BLOCK) ? simd::load(src) : simd::loadPartial(src, lanes);
+                simd::v8f e = simd::exp(simd::sub(v, _max));
+                if (b == blocks - 1)
+                    e = simd::mul(e, valid);
+                s = simd::add(s, e);
+                if (lanes == Tensor::BLOCK)
+                    simd::store(output.ptr(b) + p * lanes, e);
+                else
+                    simd::storePartial(output.ptr(b) + p * lanes, e, lanes);
+            }
+            const simd::v8f _scale = simd::set1(1.f / simd::hsum(s));
+
+            for (int b = 0; b < blocks; b++)
+            {
+                float *dst = output.ptr(b) + p * lanes;
+                if (lanes == Tensor::BLOCK)
+                    simd::store(dst, simd::mul(simd::load(dst), _scale));
+                else
+                    simd::storePartial(dst, simd::mul(simd::loadPartial(dst, lanes), _scale), lanes);
+            }
+        }
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindActivation(Kernels &kernels)
+        {
+            kernels.relu    = relu;
+            kernels.softmax = softmax;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include "arena.h"
+
+using namespace cnn;
+
+static unsigned char *alignBlock(std::vector<unsigned char> &block)
+{
+    const uintptr_t p = reinterpret_cast<uintptr_t>(block.data());
+    return block.data() + ((Arena::ALIGN - p % Arena::ALIGN) % Arena::ALIGN);
+}
+
+void Arena::reserve(size_t size)
+{
+    _used = 0;
+    _overflow.clear();
+    size = align(size);
+    if (size <= _capacity)
+        return;
+
+    std::vector<unsigned char>().swap(_buffer);
+    _buffer.resize(size + ALIGN);
+    _data     = alignBlock(_buffer);
+    _capacity = size;
+    _peak     = std::max(_peak, size);
+}
+
+void *Arena::allocate(size_t size)
+{
+    size = align(size);
+    const size_t offset = _used;
+    _used += size;
+    _peak  = std::max(_peak, _used);
+    if (_used <= _capacity)
+        return _data + offset;
+
+    Overflow overflow;
+    overflow.offset = offset;
+    overflow.block.resize(size + ALIGN);
+    _overflow.push_back(std::move(overflow));
+    return alignBlock(_overflow.back().block);
+}
+
+void Arena::release(size_t mark)
+{
+    while (!_overflow.empty() && _overflow.back().offset >= mark)
+        _overflow.pop_back();
+    _used = std::min(_used, mark);
+}
+
+void Arena::reset()
+{
+    release(0);
+    if (_peak > _capacity)
+        reserve(_peak);
+}
@@ -0,0 +1,93 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __arena__
+#define __arena__
+
+#include <cstddef>
+#include <vector>
+
+namespace cnn
+{
+    // Scratch memory handed out as a stack of 64-byte aligned blocks from one
+    // buffer. mark()/release() free everything allocated after the mark, so
+    // a caller can reuse the same memory for every layer of a forward pass.
+    //
+    // A block that does not fit is taken from the heap instead and counted
+    // in peak(); the next reset() grows the buffer to the peak, after which
+    // the same sequence of allocations no longer touches the heap.
+    class Arena
+    {
+    public:
+        enum { ALIGN = 64 };
+
+        Arena(): _data(nullptr), _capacity(0), _used(0), _peak(0) {}
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        // Bytes a block of size bytes takes from the arena.
+        static size_t align(size_t size) { return (size + ALIGN - 1) & ~static_cast<size_t>(ALIGN - 1); }
+
+        // Grows the buffer to at least size bytes. Releases every block.
+        void reserve(size_t size);
+
+        void *allocate(size_t size);
+        template<typename T>
+        T *allocate(size_t count) { return static_cast<T*>(allocate(count * sizeof(T))); }
+
+        size_t mark() const { return _used; }
+        void   release(size_t mark);
+        void   reset();
+
+        size_t capacity() const { return _capacity; }
+        // Largest amount of memory in use at once since the arena was created.
+        size_t peak() const     { return _peak; }
+
+    private:
+        struct Overflow
+        {
+            size_t offset;
+            std::vector<unsigned char> block;
+        };
+
+        std::vector<unsigned char> _buffer;
+        unsigned char *_data;
+        size_t _capacity;
+        size_t _used;
+        size_t _peak;
+        std::vector<Overflow> _overflow;
+    };
+}
+
+#endif
@@ -31,8 +31,18 @@
  
  **************************************************************************************************
  **************************************************************************************************/
+#include <bitset>
 #include <limits>
+#include <chrono>
+#include <cstring>
+#include <sstream>
 #include "cnn.h"
+#include "graph.h"
+#include "fixed.h"
+#include "parallel.h"
+#include "resample.h"
+#include "isa.h"
+#include "simd.h"
 
 using namespace cnn;
 
@@ -54,6 +64,11 @@ const string CNNStringParam::KernelW = "kW";
 const string CNNStringParam::KernelH = "kH";
 const string CNNStringParam::KernelD = "kD";
 const string CNNStringParam::NLayers = "nLayers";
+const string CNNStringParam::Algorithm = "algo";
+const string CNNStringParam::Head    = "head";
+const string CNNStringParam::QuantScale = "qScale";
+const string CNNStringParam::QuantZero  = "qZero";
+const string CNNStringParam::WeightFormat = "wfmt";
 
 
 const string CNNOpType::CONV    = "conv";
@@ -85,6 +100,173 @@ void CNNLayer::setParam(const string &param, float value)
 {
     params[param] = value;
 }
+
+int CNNLayer::algorithm() const
+{
+    map<string,float>::const_iterator it = params.find(CNNStringParam::Algorithm);
+    return (it == params.end()) ? CNNConvAlgo::AUTO : static_cast<int>(it->second);
+}
+
+int CNNLayer::head() const
+{
+    map<string,float>::const_iterator it = params.find(CNNStringParam::Head);
+    return (it == params.end()) ? CNNHead::SOFTMAX : static_cast<int>(it->second);
+}
+
+int CNNLayer::weightFormat() const
+{
+    map<string,float>::const_iterator it = params.find(CNNStringParam::WeightFormat);
+    return (it == params.end()) ? CNNWeightFormat::FP32 : static_cast<int>(it->second);
+}
+
+void CNNLayer::setWeightFormat(int format)
+{
+    // 16-bit weights are decoded with the current format, so widen them
+    // before it changes.
+    if (!matrix.empty() && matrix.depth() == CV_16U)
+    {
+        Mat _matrix(matrix.size(), CV_32F);
+        Half::widen(matrix.ptr<uint16_t>(), matrix.total(), weightFormat(), _matrix.ptr<float>());
+        const int kernelD    = static_cast<int>(weights.size()) / matrix.rows;
+        const int kernelSize = weights[0].rows * weights[0].cols;
+        for (size_t i = 0; i < weights.size(); i++)
+        {
+            const int offset = static_cast<int>(i % kernelD) * kernelSize;
+            weights[i] = _matrix.row(static_cast<int>(i) / kernelD)
+                                .colRange(offset, offset + kernelSize)
+                                .reshape(1, weights[i].rows);
+        }
+    }
+    setParam(CNNStringParam::WeightFormat, format);
+    prepare();
+}
+
+void CNNLayer::prepare()
+{
+    matrix.release();
+    packed.release();
+    blocked.release();
+    winograd2x2.release();
+    winograd4x4.release();
+    quantized.release();
+    quantScales.clear();
+    quantSums.clear();
+    if ((type != CNNOpType::CONV && type != CNNOpType::FC) || weights.empty() || bias.empty())
+        return;
+
+    const int nLayers    = static_cast<int>(bias.size());
+    const int kernelD    = static_cast<int>(weights.size()) / nLayers;
+    const int kernelSize = weights[0].rows * weights[0].cols;
+    const int K          = kernelD * kernelSize;
+    const int format     = weightFormat();
+    const bool conv      = (type == CNNOpType::CONV);
+    const int strideW    = conv ? static_cast<int>(params.at(CNNStringParam::StrideW)) : 1;
+    const int strideH    = conv ? static_cast<int>(params.at(CNNStringParam::StrideH)) : 1;
+
+    // The weights as floats, whatever they are stored as.
+    Mat _matrix(nLayers, K, CV_32F);
+    for (size_t i = 0; i < weights.size(); i++)
+    {
+        float *dst = _matrix.ptr<float>(static_cast<int>(i) / kernelD) + (i % kernelD) * kernelSize;
+        for (int r = 0; r < weights[i].rows; r++, dst += weights[i].cols)
+        {
+            if (weights[i].depth() == CV_16U)
+                Half::widen(weights[i].ptr<uint16_t>(r), weights[i].cols, format, dst);
+            else
+                memcpy(dst, weights[i].ptr<float>(r), weights[i].cols * sizeof(float));
+        }
+    }
+
+    if (format == CNNWeightFormat::FP32)
+        matrix = _matrix;
+    else
+    {
+        // Everything else is derived from the rounded weights.
+        matrix.create(nLayers, K, CV_16U);
+        Half::narrow(_matrix.ptr<float>(), _matrix.total(), format, matrix.ptr<uint16_t>());
+        Half::widen(matrix.ptr<uint16_t>(), matrix.total(), format, _matrix.ptr<float>());
+    }
+
+    // Share the matrix storage instead of keeping a second copy of the weights.
+    for (size_t i = 0; i < weights.size(); i++)
+    {
+        const int offset = static_cast<int>(i % kernelD) * kernelSize;
+        weights[i] = matrix.row(static_cast<int>(i) / kernelD)
+                           .colRange(offset, offset + kernelSize)
+                           .reshape(1, weights[i].rows);
+    }
+
+    if (format == CNNWeightFormat::FP32 ||
+        Direct::kernel(weights[0].cols, weights[0].rows, strideW, strideH, format) == nullptr)
+    {
+        packed.create(1, static_cast<int>(Gemm::packedASize(nLayers, K)), CV_32F);
+        Gemm::packA(nLayers, K, _matrix.ptr<float>(), K, packed.ptr<float>());
+    }
+
+    const size_t blockedSize = Direct::blockedSize(nLayers, K);
+    if (format == CNNWeightFormat::FP32)
+    {
+        blocked.create(1, static_cast<int>(blockedSize), CV_32F);
+        Direct::blockWeights(nLayers, K, _matrix.ptr<float>(), blocked.ptr<float>());
+    }
+    else
+    {
+        vector<float> _blocked(blockedSize);
+        Direct::blockWeights(nLayers, K, _matrix.ptr<float>(), &_blocked[0]);
+        blocked.create(1, static_cast<int>(blockedSize), CV_16U);
+        Half::narrow(&_blocked[0], blockedSize, format, blocked.ptr<uint16_t>());
+    }
+
+    if (conv && format == CNNWeightFormat::FP32 &&
+        Winograd::applicable(weights[0].cols, weights[0].rows, strideW, strideH))
+    {
+        transformWinograd(2, nLayers, kernelD, winograd2x2);
+        transformWinograd(4, nLayers, kernelD, winograd4x4);
+    }
+
+    if (params.count(CNNStringParam::QuantScale))
+    {
+        // Reorder k from (channel, ky, kx) to the (ky, kx, channel) of the
+        // int8 im2col.
+        Mat _reordered(nLayers, K, CV_32F);
+        for (int m = 0; m < nLayers; m++)
+            for (int c = 0; c < kernelD; c++)
+                for (int k = 0; k < kernelSize; k++)
+                    _reordered.at<float>(m, k * kernelD + c) = _matrix.at<float>(m, c * kernelSize + k);
+
+        quantized.create(1, static_cast<int>(Quant::packedSize(nLayers, K)), CV_8S);
+        quantScales.resize(nLayers);
+        quantSums.resize(nLayers);
+        Quant::packWeights(nLayers, K, _reordered.ptr<float>(), quantized.ptr<int8_t>(),
+                           &quantScales[0], &quantSums[0]);
+    }
+}
+
+void CNNLayer::transformWinograd(int tile, int nLayers, int kernelD, Mat &transformed) const
+{
+    const int alpha    = Winograd::alpha(tile);
+    const int elements = alpha * alpha;
+    const size_t pairs = static_cast<size_t>(nLayers) * kernelD;
+
+    // U[e][layer][depth], then every element is blocked as 1x1 direct weights.
+    vector<float> _u(elements * pairs);
+    for (size_t i = 0; i < weights.size(); i++)
+    {
+        float g[9];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                g[r * 3 + c] = weights[i].at<float>(r, c);
+        Winograd::transformKernel(tile, g, &_u[i], pairs);
+    }
+
+    const size_t block = Direct::blockedSize(nLayers, kernelD);
+    transformed.create(1, static_cast<int>(block * elements), CV_32F);
+    for (int e = 0; e < elements; e++)
+    {
+        Direct::blockWeights(nLayers, kernelD, &_u[e * pairs],
+                             transformed.ptr<float>() + e * block);
+    }
+}
 void CNNLayer::write(FileStorage &fs) const
 {
     fs << "{";
@@ -161,7 +343,7 @@ void CNNLayer::read(const FileNode& node)
         for (; it != it_end; ++it)
         {
             string name = (*it).name();
-            int value;
+            float value;
             (*it) >> value;
             params[name] = value;
             
@@ -170,75 +352,793 @@ void CNNLayer::read(const FileNode& node)
     
 }
 
-void CNN::forward(const Mat &input, vector<Mat> &output) const
+void CNN::compile()
 {
-    vector<Mat> _input;
-    split(input, _input);
-    
+    {
+        lock_guard<mutex> lock(_cache.lock);
+        _cache.plans.clear();
+    }
+
+    _steps.clear();
     for (size_t i = 0; i < _network.size(); i++)
     {
-        const CNNLayer &layer = _layers[_map.at(_network[i])];
-        
-        bool lastLayer = (i == _network.size() - 1);
-        
-        vector<Mat> _tmp;
-        
-        if (layer.type == cnn::CNNOpType::CONV)
-        {
-            cnn::Op::CONV(_input, layer.weights, _tmp, layer.bias,
-                          layer.params.at(cnn::CNNStringParam::NLayers),
-                          layer.params.at(cnn::CNNStringParam::KernelD),
-                          layer.params.at(cnn::CNNStringParam::StrideW),
-                          layer.params.at(cnn::CNNStringParam::StrideH),
-                          layer.params.at(cnn::CNNStringParam::PadW),
-                          layer.params.at(cnn::CNNStringParam::PadH));
-            
+        const size_t l = _map.at(_network[i]);
+        _steps.push_back(Graph::lower(_layers[l], l));
+    }
+    Graph::optimize(_steps, _layers);
+    Graph::fuse(_steps);
+}
+
+void CNN::printFlops(const Size &size, int channels, ostream &out) const
+{
+    vector<CNNStep> _original;
+    for (size_t i = 0; i < _network.size(); i++)
+    {
+        const size_t l = _map.at(_network[i]);
+        _original.push_back(Graph::lower(_layers[l], l));
+    }
+    Graph::fuse(_original);
+
+    const vector<CNNStep> *lists[] = { &_original, &_steps };
+    const char *labels[]           = { "before", "after" };
+    double totals[2];
+    out << _name << " " << size.width << "x" << size.height << endl;
+    for (int k = 0; k < 2; k++)
+    {
+        vector<double> _flops;
+        totals[k] = Graph::flops(*lists[k], channels, size.height, size.width, &_flops);
+        out << "  " << labels[k] << ":";
+        for (size_t i = 0; i < lists[k]->size(); i++)
+        {
+            const CNNStep &step = (*lists[k])[i];
+            out << " " << (step.derived ? step.derived->type : _layers[step.layer].type)
+                << " " << _flops[i] * 1e-6;
         }
-        else if (layer.type == cnn::CNNOpType::RELU)
+        out << endl;
+    }
+    out << "  MFLOP " << totals[0] * 1e-6 << " -> " << totals[1] * 1e-6 << endl;
+}
+
+// Picks the convolution engine for a CONV/FC step on an input of the given
+// shape. An explicit choice, or failing that the tuned one (preferred), is
+// honoured when the layer supports it. AUTO goes to GEMV for FC layers that
+// reduce the input to one pixel, to Winograd F(4x4) for stride 1 3x3 layers
+// over blocked inputs whose output spans a few tiles, to a specialized
+// direct kernel when one exists, and to GEMM otherwise.
+static int resolveAlgorithm(const CNNStep &step, int channels, int rows, int cols,
+                            int preferred = CNNConvAlgo::AUTO)
+{
+    const int outputW = (cols + 2 * step.padW - step.kernelW) / step.strideW + 1;
+    const int outputH = (rows + 2 * step.padH - step.kernelH) / step.strideH + 1;
+
+    // The Winograd transforms work on whole blocks of input channels.
+    const bool winograd    = step.winograd && channels >= Tensor::BLOCK;
+    const bool specialized = step.direct != nullptr;
+    const bool gemv        = step.op == CNNStep::FC && outputW == 1 && outputH == 1;
+
+    int algorithm = (step.algorithm != CNNConvAlgo::AUTO) ? step.algorithm : preferred;
+    if ((algorithm == CNNConvAlgo::WINOGRAD2X2 || algorithm == CNNConvAlgo::WINOGRAD4X4) && !winograd)
+        algorithm = CNNConvAlgo::AUTO;
+    if (algorithm == CNNConvAlgo::SPECIALIZED && !specialized)
+        algorithm = CNNConvAlgo::AUTO;
+    if (algorithm == CNNConvAlgo::GEMV && !gemv)
+        algorithm = CNNConvAlgo::AUTO;
+    if (algorithm == CNNConvAlgo::INT8 && !step.int8)
+        algorithm = CNNConvAlgo::AUTO;
+    if ((algorithm == CNNConvAlgo::DIRECT && !step.reference) || (algorithm == CNNConvAlgo::GEMM && !step.gemm))
+        algorithm = CNNConvAlgo::AUTO;
+
+    if (algorithm != CNNConvAlgo::AUTO)
+        return algorithm;
+
+    if (gemv)
+        return CNNConvAlgo::GEMV;
+
+    if (winograd && std::min(outputW, outputH) >= 8)
+        return CNNConvAlgo::WINOGRAD4X4;
+
+    if (specialized)
+        return CNNConvAlgo::SPECIALIZED;
+
+    return CNNConvAlgo::GEMM;
+}
+
+// Bytes of scratch the Op of a call takes from the arena on an input of the
+// given shape; mirrors the allocations of the Ops. The reference CONV and FC
+// allocate their own planes.
+static size_t scratchSize(const CNNStep &step, const CNNCall &call, int channels, int rows, int cols)
+{
+    const int lanes = std::min<int>(channels, Tensor::BLOCK);
+    if (step.op == CNNStep::MAXPOOL)
+        return MaxPool::scratchSize(step.window, call.cols, lanes);
+    if (step.op != CNNStep::CONV && step.op != CNNStep::FC)
+        return 0;
+
+    const int paddedW   = cols + 2 * step.padW;
+    const int paddedH   = rows + 2 * step.padH;
+    const int outputW   = (paddedW - step.kernelW) / step.strideW + 1;
+    const int outputH   = (paddedH - step.kernelH) / step.strideH + 1;
+    const int N         = outputW * outputH;
+    const int K         = step.kernelD * step.kernelW * step.kernelH;
+    const size_t padded = (step.padW || step.padH) ? Tensor::bytes(channels, paddedH, paddedW) : 0;
+
+    switch (call.algorithm)
+    {
+        case CNNConvAlgo::INT8:
         {
-            cnn::Op::RELU(_input, _tmp);
+            const size_t accRow = Gemm::roundUp(step.nLayers, Quant::BLOCK);
+            return Arena::align(static_cast<size_t>(paddedW) * paddedH * step.kernelD) +
+                   Arena::align(static_cast<size_t>(cols) * lanes) +
+                   Arena::align(Op::INT8_CHUNK * Quant::rowSize(K)) +
+                   Arena::align(Op::INT8_CHUNK * accRow * sizeof(int32_t)) +
+                   2 * Arena::align(accRow * sizeof(float));
         }
-        else if (layer.type == cnn::CNNOpType::SOFTMAX)
+        case CNNConvAlgo::WINOGRAD2X2:
+        case CNNConvAlgo::WINOGRAD4X4:
         {
-            cnn::Op::SOFTMAX(_input, _tmp);
+            const int tile     = (call.algorithm == CNNConvAlgo::WINOGRAD4X4) ? 4 : 2;
+            const int elements = Winograd::alpha(tile) * Winograd::alpha(tile);
+            const int tiles    = ((outputW + tile - 1) / tile) * ((outputH + tile - 1) / tile);
+            const int chunk    = std::min<int>(tiles, Op::WINOGRAD_CHUNK);
+            return Tensor::bytes(step.kernelD, elements, chunk) +
+                   Tensor::bytes(Gemm::roundUp(step.nLayers, Tensor::BLOCK), elements, chunk);
         }
-        else if (layer.type == cnn::CNNOpType::MAXPOOL)
+        case CNNConvAlgo::GEMV:
+            return Arena::align(static_cast<size_t>(channels) * rows * cols * sizeof(float)) +
+                   Arena::align(step.nLayers * sizeof(float));
+        case CNNConvAlgo::GEMM:
+            return Arena::align(static_cast<size_t>(step.nLayers) * N * sizeof(float)) +
+                   Arena::align(Gemm::packedBSize(std::min<int>(Gemm::KC, K), std::min<int>(Gemm::NC, N)) * sizeof(float));
+        case CNNConvAlgo::SPECIALIZED:
+            return padded + (call.pool ? Direct::pooledScratch(step.window) : 0);
+        default:
+            return 0;
+    }
+}
+
+void CNN::plan(const Size &size, int channels, CNNShapePlan &plan, int threads, bool regions) const
+{
+    this->plan(size, channels, threads, regions, _tuning.get(), plan);
+}
+
+void CNN::plan(const Size &size, int channels, int threads, bool regions,
+               const Tuning *tuning, CNNShapePlan &plan) const
+{
+    plan.input    = size;
+    plan.channels = channels;
+    plan.threads  = threads;
+    plan.regions  = regions;
+    plan.calls.clear();
+    plan.slots[0] = Tensor::bytes(channels, size.height, size.width);
+    plan.slots[1] = 0;
+    plan.scratch  = 0;
+
+    int rows = size.height;
+    int cols = size.width;
+    for (size_t i = 0; i < _steps.size(); i++)
+    {
+        const CNNStep &step = _steps[i];
+        CNNCall call  = CNNCall();
+        call.step      = i;
+        call.algorithm = CNNConvAlgo::AUTO;
+        call.channels  = channels;
+        call.rows      = rows;
+        call.cols      = cols;
+
+        if (step.op == CNNStep::SOFTMAX)
         {
-            cnn::Op::MAX_POOL(_input, _tmp,
-                              layer.params.at(cnn::CNNStringParam::KernelW),
-                              layer.params.at(cnn::CNNStringParam::KernelH),
-                              layer.params.at(cnn::CNNStringParam::StrideW),
-                              layer.params.at(cnn::CNNStringParam::StrideH),
-                              layer.params.at(cnn::CNNStringParam::PadW),
-                              layer.params.at(cnn::CNNStringParam::PadH));
+            if (channels == 2 && step.head != CNNHead::SOFTMAX)
+                call.channels = 1;
         }
-        else if (layer.type == cnn::CNNOpType::FC)
+        else if (step.op == CNNStep::MAXPOOL)
         {
-            cnn::Op::FC(_input, layer.weights, layer.bias,
-                        _tmp, layer.params.at(cnn::CNNStringParam::NLayers));
+            call.cols = MaxPool::outputSize(cols, step.window.width, step.window.strideW, step.window.padW);
+            call.rows = MaxPool::outputSize(rows, step.window.height, step.window.strideH, step.window.padH);
+            call.flops = static_cast<double>(step.window.width) * step.window.height *
+                         channels * call.rows * call.cols;
         }
-        
-        if (_debug)
+        else if (step.op == CNNStep::CONV || step.op == CNNStep::FC)
         {
-            cout << _network[i] << endl; 
-            for (size_t k = 0; k < _tmp.size(); k++)
+            const int tuned = (tuning && step.algorithm == CNNConvAlgo::AUTO) ?
+                              tuning->find(tuningKey(step, channels, rows, cols, threads)) :
+                              static_cast<int>(CNNConvAlgo::AUTO);
+            call.algorithm = resolveAlgorithm(step, channels, rows, cols, tuned);
+            call.channels  = step.nLayers;
+            call.cols      = (cols + 2 * step.padW - step.kernelW) / step.strideW + 1;
+            call.rows      = (rows + 2 * step.padH - step.kernelH) / step.strideH + 1;
+            call.flops     = 2. * step.kernelD * step.kernelW * step.kernelH * step.nLayers *
+                             call.rows * call.cols;
+
+            const bool winograd = (call.algorithm == CNNConvAlgo::WINOGRAD2X2 ||
+                                   call.algorithm == CNNConvAlgo::WINOGRAD4X4);
+            // Over regions the input of a padded pool is masked first.
+            const bool padded = step.window.padW > 0 || step.window.padH > 0;
+            if (call.algorithm == CNNConvAlgo::SPECIALIZED && step.pooledSpan > 0 && !(regions && padded))
             {
-                printf("%d %d\n", _tmp[k].rows, _tmp[k].cols);
-                cout << _tmp[k] << endl;
+                call.pool = true;
+                call.relu = step.pooledRelu;
+                call.cols = MaxPool::outputSize(call.cols, step.window.width, step.window.strideW, step.window.padW);
+                call.rows = MaxPool::outputSize(call.rows, step.window.height, step.window.strideH, step.window.padH);
+                i += step.pooledSpan;
             }
+            else if ((call.algorithm == CNNConvAlgo::SPECIALIZED || call.algorithm == CNNConvAlgo::GEMV ||
+                      call.algorithm == CNNConvAlgo::INT8 || winograd) && step.reluNext)
+            {
+                call.relu = true;
+                i++;
+            }
+        }
+        call.last    = i;
+        call.scratch = scratchSize(step, call, channels, rows, cols);
+
+        size_t &slot  = plan.slots[(plan.calls.size() + 1) % 2];
+        slot          = std::max(slot, Tensor::bytes(call.channels, call.rows, call.cols));
+        plan.scratch  = std::max(plan.scratch, call.scratch);
+        plan.calls.push_back(call);
+
+        channels = call.channels;
+        rows     = call.rows;
+        cols     = call.cols;
+    }
+}
+
+Tuning::Key CNN::tuningKey(const CNNStep &step, int channels, int rows, int cols, int threads) const
+{
+    Tuning::Key key;
+    for (map<string, size_t>::const_iterator it = _map.begin(); it != _map.end(); ++it)
+        if (it->second == step.layer)
+            key.layer = it->first;
+    key.outputs  = step.nLayers;
+    key.channels = channels;
+    key.rows     = rows;
+    key.cols     = cols;
+    key.threads  = threads;
+    key.isa      = Isa::name(Isa::level());
+    return key;
+}
+
+size_t CNN::arenaSize(const Size &size, int channels, int threads) const
+{
+    CNNShapePlan _plan;
+    plan(size, channels, _plan, threads);
+    return _plan.arenaSize();
+}
+
+shared_ptr<const CNNShapePlan> CNN::cachedPlan(const Size &size, int channels, int threads,
+                                               bool regions) const
+{
+    const CNNPlanCache::Key key(channels, threads, size.height, size.width, regions);
+    {
+        lock_guard<mutex> lock(_cache.lock);
+        map<CNNPlanCache::Key, shared_ptr<const CNNShapePlan> >::const_iterator it = _cache.plans.find(key);
+        if (it != _cache.plans.end())
+        {
+            _cache.hits++;
+            return it->second;
+        }
+        _cache.misses++;
+    }
+
+    shared_ptr<CNNShapePlan> _plan = make_shared<CNNShapePlan>();
+    plan(size, channels, *_plan, threads, regions);
+
+    lock_guard<mutex> lock(_cache.lock);
+    if (_cache.plans.size() >= CNNPlanCache::CAPACITY)
+        _cache.plans.clear();
+    _cache.plans[key] = _plan;
+    return _plan;
+}
+
+void CNN::setTuning(const shared_ptr<const Tuning> &tuning)
+{
+    _tuning = tuning;
+    lock_guard<mutex> lock(_cache.lock);
+    _cache.plans.clear();
+}
+
+void CNN::tune(const Size &size, int channels, int threads, Tuning &tuning, int repeats) const
+{
+    static const int candidates[] = {
+        CNNConvAlgo::GEMM, CNNConvAlgo::WINOGRAD2X2, CNNConvAlgo::WINOGRAD4X4,
+        CNNConvAlgo::SPECIALIZED, CNNConvAlgo::GEMV
+    };
+
+    Tuning _trial = _tuning ? *_tuning : Tuning();
+    Mat _input(size, CV_32FC(channels));
+    randu(_input, Scalar::all(-1.), Scalar::all(1.));
+    Arena _arena;
+    Tensor _output;
+    CNNShapePlan _plan;
+    plan(size, channels, threads, false, &_trial, _plan);
+
+    // Shapes of the AUTO CONV and FC calls, which fusing with another
+    // engine does not change.
+    vector<pair<size_t, Vec3i> > _tuned;
+    int depth = channels, rows = size.height, cols = size.width;
+    for (size_t k = 0; k < _plan.calls.size(); k++)
+    {
+        const CNNCall &call = _plan.calls[k];
+        const CNNStep &step = _steps[call.step];
+        if ((step.op == CNNStep::CONV || step.op == CNNStep::FC) && step.algorithm == CNNConvAlgo::AUTO)
+            _tuned.push_back(make_pair(call.step, Vec3i(depth, rows, cols)));
+        depth = call.channels;
+        rows  = call.rows;
+        cols  = call.cols;
+    }
+
+    for (size_t l = 0; l < _tuned.size(); l++)
+    {
+        const CNNStep &step   = _steps[_tuned[l].first];
+        const Vec3i &shape    = _tuned[l].second;
+        const Tuning::Key key = tuningKey(step, shape[0], shape[1], shape[2], threads);
+
+        int best      = CNNConvAlgo::AUTO;
+        double bestMs = 0.;
+        for (size_t a = 0; a < sizeof(candidates) / sizeof(candidates[0]); a++)
+        {
+            if (resolveAlgorithm(step, shape[0], shape[1], shape[2], candidates[a]) != candidates[a])
+                continue;
+            _trial.set(key, candidates[a], 0.);
+            plan(size, channels, threads, false, &_trial, _plan);
+
+            forward(_input, _output, _plan, _arena, threads, nullptr);
+            double ms = numeric_limits<double>::max();
+            for (int r = 0; r < std::max(repeats, 1); r++)
+            {
+                const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                forward(_input, _output, _plan, _arena, threads, nullptr);
+                const chrono::steady_clock::time_point end = chrono::steady_clock::now();
+                ms = std::min(ms, chrono::duration<double, milli>(end - start).count());
+            }
+            if (best == CNNConvAlgo::AUTO || ms < bestMs)
+            {
+                best   = candidates[a];
+                bestMs = ms;
+            }
+        }
+        if (best == CNNConvAlgo::AUTO)
+            continue;
+        _trial.set(key, best, bestMs);
+        tuning.set(key, best, bestMs);
+    }
+}
+
+size_t CNN::planCacheHits() const
+{
+    lock_guard<mutex> lock(_cache.lock);
+    return _cache.hits;
+}
+
+size_t CNN::planCacheMisses() const
+{
+    lock_guard<mutex> lock(_cache.lock);
+    return _cache.misses;
+}
+
+void CNN::forward(const Mat &input, vector<Mat> &output) const
+{
+    Workspace _workspace;
+    forward(input, output, _workspace);
+}
+
+void CNN::forward(const Mat &input, vector<Mat> &output, Workspace &workspace) const
+{
+    forward(input, output, *cachedPlan(input.size(), input.channels(), workspace.threads), workspace.arena,
+            workspace.threads);
+}
+
+void CNN::forward(const Mat &input, vector<Mat> &output, const CNNShapePlan &plan, Arena &arena,
+                  int threads) const
+{
+    Tensor _output;
+    forward(input, _output, plan, arena, threads, nullptr);
+    _output.toPlanes(output);
+}
+
+void CNN::forward(const Mat &input, Tensor &output, const CNNShapePlan &plan, Arena &arena,
+                  int threads) const
+{
+    forward(input, output, plan, arena, threads, nullptr);
+}
+
+// The output of a layer with the given window over region, as a pass over
+// the region alone would give it.
+static Rect mapRegion(const Rect &region, int windowW, int windowH, int strideW, int strideH,
+                      int padW, int padH)
+{
+    CV_Assert(region.x % strideW == 0 && region.y % strideH == 0);
+    return Rect(region.x / strideW, region.y / strideH,
+                MaxPool::outputSize(region.width, windowW, strideW, padW),
+                MaxPool::outputSize(region.height, windowH, strideH, padH));
+}
+
+// Sets tensor to value outside regions: the padding a layer sees around
+// each of them.
+static void maskRegions(Tensor &tensor, vector<Rect> regions, float value)
+{
+    sort(regions.begin(), regions.end(), [](const Rect &a, const Rect &b) { return a.x < b.x; });
+    const int lanes = tensor.lanes();
+    for (int b = 0; b < tensor.blocks(); b++)
+    {
+        const int used = std::min(lanes, tensor.channels() - b * Tensor::BLOCK);
+        for (int y = 0; y < tensor.rows(); y++)
+        {
+            float *row = tensor.ptr(b, y);
+            int x = 0;
+            for (size_t i = 0; i <= regions.size(); i++)
+            {
+                if (i < regions.size() && (y < regions[i].y || y >= regions[i].y + regions[i].height))
+                    continue;
+                const int end = (i < regions.size()) ? std::min(regions[i].x, tensor.cols()) : tensor.cols();
+                for (; x < end; x++)
+                    std::fill(row + x * lanes, row + x * lanes + used, value);
+                if (i < regions.size())
+                    x = std::max(x, regions[i].x + regions[i].width);
+            }
+        }
+    }
+}
+
+void CNN::forward(const Mat &input, Tensor &output, const CNNShapePlan &plan,
+                  Arena &arena, int threads, vector<Vec2f> *ranges, vector<Rect> *regions) const
+{
+    CV_Assert(input.size() == plan.input && input.channels() == plan.channels);
+    CV_Assert(!regions || plan.regions);
+
+    arena.reset();
+    arena.reserve(plan.arenaSize());
+    void *slots[2] = { arena.allocate(plan.slots[0]), arena.allocate(plan.slots[1]) };
+    const size_t mark = arena.mark();
+
+    Tensor _input;
+    _input.create(plan.channels, plan.input.height, plan.input.width, slots[0]);
+    _input.fromMat(input);
+
+    for (size_t k = 0; k < plan.calls.size(); k++)
+    {
+        const CNNCall &call = plan.calls[k];
+        const CNNStep &step = _steps[call.step];
+
+        Tensor _tmp;
+        _tmp.create(call.channels, call.rows, call.cols, slots[(k + 1) % 2]);
+
+        if (ranges && (step.op == CNNStep::CONV || step.op == CNNStep::FC))
+        {
+            Vec2f &range = (*ranges)[step.layer];
+            for (int b = 0; b < _input.blocks(); b++)
+            {
+                const float *src = _input.ptr(b);
+                const size_t n   = _input.rows() * _input.rowStep();
+                for (size_t i = 0; i < n; i++)
+                {
+                    range[0] = std::min(range[0], src[i]);
+                    range[1] = std::max(range[1], src[i]);
+                }
+            }
+        }
+
+        // Outside the regions the input holds the padding of the layer, or
+        // zeros that keep what is left there from mixing into them.
+        if (regions && step.op == CNNStep::MAXPOOL)
+        {
+            const MaxPool::Window &window = step.window;
+            maskRegions(_input, *regions, (window.padW > 0 || window.padH > 0) ?
+                                          std::numeric_limits<float>::lowest() : 0.f);
+            for (size_t i = 0; i < regions->size(); i++)
+                (*regions)[i] = mapRegion((*regions)[i], window.width, window.height,
+                                          window.strideW, window.strideH, window.padW, window.padH);
+        }
+        else if (regions && (step.op == CNNStep::CONV || step.op == CNNStep::FC))
+        {
+            const MaxPool::Window &window = step.window;
+            maskRegions(_input, *regions, 0.f);
+            for (size_t i = 0; i < regions->size(); i++)
+            {
+                Rect &region = (*regions)[i];
+                region = mapRegion(region, step.kernelW, step.kernelH, step.strideW, step.strideH,
+                                   step.padW, step.padH);
+                if (call.pool)
+                    region = mapRegion(region, window.width, window.height,
+                                       window.strideW, window.strideH, window.padW, window.padH);
+            }
+        }
+
+        run(call, _input, _tmp, arena, Parallel::parts(call.flops, threads));
+        arena.release(mark);
+
+        if (_debug)
+            dump(step, _tmp);
+        _input = _tmp;
+    }
+    output = _input;
+}
+
+void CNN::run(const CNNCall &call, const Tensor &input, Tensor &output, Arena &arena, int parts) const
+{
+    const CNNStep &step   = _steps[call.step];
+    const CNNLayer &layer = step.derived ? *step.derived : _layers[step.layer];
+
+    if (step.op == CNNStep::RELU)
+    {
+        cnn::Op::RELU(input, output);
+        return;
+    }
+    if (step.op == CNNStep::SOFTMAX)
+    {
+        cnn::Op::SOFTMAX(input, output, step.head);
+        return;
+    }
+    if (step.op == CNNStep::MAXPOOL)
+    {
+        cnn::Op::MAX_POOL(input, output,
+                          step.window.width, step.window.height,
+                          step.window.strideW, step.window.strideH,
+                          step.window.padW, step.window.padH, &arena, parts);
+        return;
+    }
+
+    const int algorithm = call.algorithm;
+    const bool conv     = (step.op == CNNStep::CONV);
+
+    if (algorithm == CNNConvAlgo::INT8)
+    {
+        cnn::Op::CONV_INT8(input, layer.quantized, layer.quantScales, layer.quantSums,
+                           output, layer.bias, step.nLayers, step.kernelD,
+                           step.kernelW, step.kernelH, step.strideW, step.strideH,
+                           step.padW, step.padH, step.activation, call.relu, &arena, parts);
+    }
+    else if (conv && algorithm == CNNConvAlgo::DIRECT)
+    {
+        cnn::Op::CONV(input, layer.weights, output, layer.bias, step.nLayers, step.kernelD,
+                      step.strideW, step.strideH, step.padW, step.padH);
+    }
+    else if (algorithm == CNNConvAlgo::DIRECT)
+    {
+        cnn::Op::FC(input, layer.weights, layer.bias, output, step.nLayers);
+    }
+    else if (algorithm == CNNConvAlgo::WINOGRAD2X2 || algorithm == CNNConvAlgo::WINOGRAD4X4)
+    {
+        const bool f4 = (algorithm == CNNConvAlgo::WINOGRAD4X4);
+        cnn::Op::CONV_WINOGRAD(input, f4 ? layer.winograd4x4 : layer.winograd2x2,
+                               output, layer.bias, step.nLayers, step.kernelD,
+                               step.padW, step.padH, f4 ? 4 : 2, call.relu, &arena, parts);
+    }
+    else if (call.pool)
+    {
+        cnn::Op::CONV_POOL(input, layer.blocked, output, layer.bias, step.nLayers, step.kernelD,
+                           step.kernelW, step.kernelH, step.strideW, step.strideH,
+                           step.padW, step.padH,
+                           step.window.width, step.window.height,
+                           step.window.strideW, step.window.strideH,
+                           step.window.padW, step.window.padH,
+                           call.relu, step.weightFormat, &arena, parts);
+    }
+    else if (algorithm == CNNConvAlgo::SPECIALIZED)
+    {
+        cnn::Op::CONV_DIRECT(input, layer.blocked, output, layer.bias, step.nLayers, step.kernelD,
+                             step.kernelW, step.kernelH, step.strideW, step.strideH,
+                             step.padW, step.padH, call.relu, step.weightFormat, &arena, parts);
+    }
+    else if (algorithm == CNNConvAlgo::GEMV)
+    {
+        cnn::Op::FC_GEMV(input, layer.matrix, layer.bias, output, step.nLayers, call.relu,
+                         step.weightFormat, &arena, parts);
+    }
+    else
+    {
+        cnn::Op::CONV_GEMM(input, layer.packed, output, layer.bias, step.nLayers, step.kernelD,
+                           step.kernelW, step.kernelH, step.strideW, step.strideH,
+                           step.padW, step.padH, &arena, parts);
+    }
+}
+
+void CNN::dump(const CNNStep &step, const Tensor &output) const
+{
+    vector<Mat> _planes;
+    output.toPlanes(_planes);
+    ostringstream dump;
+    dump << _layers[step.layer].type << " " << step.layer << endl;
+    for (size_t i = 0; i < _planes.size(); i++)
+        dump << _planes[i].rows << " " << _planes[i].cols << endl << _planes[i] << endl;
+
+    static mutex _lock;
+    lock_guard<mutex> lock(_lock);
+    cout << dump.str();
+}
+
+void CNN::forward(const Mat &input, const vector<Rect> &regions, vector<Mat> &output,
+                  vector<Rect> &outputRegions, Workspace &workspace) const
+{
+    outputRegions = regions;
+    Tensor _output;
+    forward(input, _output, *cachedPlan(input.size(), input.channels(), workspace.threads, true),
+            workspace.arena, workspace.threads, nullptr, &outputRegions);
+    _output.toPlanes(output);
+}
+
+int CNN::stride() const
+{
+    int stride = 1;
+    for (size_t i = 0; i < _steps.size(); i++)
+    {
+        if (_steps[i].op == CNNStep::CONV || _steps[i].op == CNNStep::FC)
+            stride *= _steps[i].strideW;
+        else if (_steps[i].op == CNNStep::MAXPOOL)
+            stride *= _steps[i].window.strideW;
+    }
+    return stride;
+}
+
+Size CNN::field() const
+{
+    // Input rows the first n output rows read, from the last layer back.
+    Size field(1, 1);
+    for (size_t i = _steps.size(); i-- > 0; )
+    {
+        const CNNStep &step = _steps[i];
+        if (step.op == CNNStep::CONV || step.op == CNNStep::FC)
+            field = Size((field.width - 1) * step.strideW + step.kernelW - step.padW,
+                         (field.height - 1) * step.strideH + step.kernelH - step.padH);
+        else if (step.op == CNNStep::MAXPOOL)
+            field = Size((field.width - 1) * step.window.strideW + step.window.width - step.window.padW,
+                         (field.height - 1) * step.window.strideH + step.window.height - step.window.padH);
+    }
+    return field;
+}
+
+// A GEMV call of a batched pass, which runs as one FC_GEMM over a large
+// enough batch when the layer has packed weights.
+static bool batchedGemm(const CNNStep &step, const CNNCall &call, int batch)
+{
+    return batch >= Op::FC_GEMM_BATCH && call.algorithm == CNNConvAlgo::GEMV && step.gemm;
+}
+
+size_t CNN::arenaSize(const CNNShapePlan &plan, int batch) const
+{
+    size_t scratch = plan.scratch;
+    int channels = plan.channels, rows = plan.input.height, cols = plan.input.width;
+    for (size_t k = 0; k < plan.calls.size(); k++)
+    {
+        const CNNCall &call = plan.calls[k];
+        const CNNStep &step = _steps[call.step];
+        if (batchedGemm(step, call, batch))
+            scratch = std::max(scratch, Op::fcGemmScratch(step.nLayers, channels * rows * cols, batch));
+        channels = call.channels;
+        rows     = call.rows;
+        cols     = call.cols;
+    }
+    return batch * (plan.slots[0] + plan.slots[1]) + scratch;
+}
+
+void CNN::forward(const vector<Mat> &inputs, vector<vector<Mat> > &outputs) const
+{
+    Workspace _workspace;
+    forward(inputs, outputs, _workspace);
+}
+
+void CNN::forward(const vector<Mat> &inputs, vector<vector<Mat> > &outputs, Workspace &workspace) const
+{
+    outputs.resize(inputs.size());
+    if (inputs.empty())
+        return;
+
+    vector<Tensor> _outputs;
+    forward(inputs, _outputs, *cachedPlan(inputs[0].size(), inputs[0].channels(), workspace.threads),
+            workspace.arena, workspace.threads);
+    for (size_t n = 0; n < inputs.size(); n++)
+        _outputs[n].toPlanes(outputs[n]);
+}
+
+void CNN::forward(const vector<Mat> &inputs, vector<Tensor> &outputs, const CNNShapePlan &plan,
+                  Arena &arena, int threads) const
+{
+    const int batch = static_cast<int>(inputs.size());
+    outputs.resize(batch);
+    if (batch == 0)
+        return;
+    for (int n = 0; n < batch; n++)
+        CV_Assert(inputs[n].size() == plan.input && inputs[n].channels() == plan.channels);
+
+    // Slot s of input n at slots[s] + n * plan.slots[s].
+    arena.reset();
+    arena.reserve(arenaSize(plan, batch));
+    unsigned char *slots[2] = {
+        static_cast<unsigned char*>(arena.allocate(batch * plan.slots[0])),
+        static_cast<unsigned char*>(arena.allocate(batch * plan.slots[1]))
+    };
+    const size_t mark = arena.mark();
+
+    vector<Tensor> _inputs(batch), _tmp(batch);
+    for (int n = 0; n < batch; n++)
+    {
+        _inputs[n].create(plan.channels, plan.input.height, plan.input.width, slots[0] + n * plan.slots[0]);
+        _inputs[n].fromMat(inputs[n]);
+    }
+
+    for (size_t k = 0; k < plan.calls.size(); k++)
+    {
+        const CNNCall &call   = plan.calls[k];
+        const CNNStep &step   = _steps[call.step];
+        const int slot        = (k + 1) % 2;
+        for (int n = 0; n < batch; n++)
+            _tmp[n].create(call.channels, call.rows, call.cols, slots[slot] + n * plan.slots[slot]);
+
+        const int parts = Parallel::parts(call.flops, threads);
+        if (batchedGemm(step, call, batch))
+        {
+            const CNNLayer &layer = step.derived ? *step.derived : _layers[step.layer];
+            cnn::Op::FC_GEMM(_inputs, layer.packed, layer.bias, _tmp, step.nLayers, call.relu,
+                             &arena, Parallel::parts(call.flops * batch, threads));
         }
-        if (lastLayer)
+        else if (parts > 1)
         {
-            output = std::move(_tmp);
+            for (int n = 0; n < batch; n++)
+            {
+                run(call, _inputs[n], _tmp[n], arena, parts);
+                arena.release(mark);
+            }
         }
         else
         {
-            _input = std::move(_tmp);
+            // Too small to split, so the batch is split instead.
+            const int chunks = std::min(batch, Parallel::parts(call.flops * batch, threads));
+            Parallel::run(chunks, [&](int chunk, Arena &scratch)
+            {
+                for (int n = batch * chunk / chunks; n < batch * (chunk + 1) / chunks; n++)
+                    run(call, _inputs[n], _tmp[n], scratch, 1);
+            }, arena);
         }
+        arena.release(mark);
+
+        if (_debug)
+            for (int n = 0; n < batch; n++)
+                dump(step, _tmp[n]);
+        _inputs.swap(_tmp);
     }
+    outputs.swap(_inputs);
 }
 
 
+void CNN::setWeightFormat(int format)
+{
+    for (size_t l = 0; l < _layers.size(); l++)
+        if (_layers[l].type == CNNOpType::FC)
+            _layers[l].setWeightFormat(format);
+    compile();
+}
+
+void CNN::quantize(const vector<Mat> &images)
+{
+    vector<Vec2f> _ranges(_layers.size(), Vec2f(0.f, 0.f));
+    CNNShapePlan _plan;
+    Arena _arena;
+    Tensor _output;
+    for (size_t k = 0; k < images.size(); k++)
+    {
+        if (k == 0 || images[k].size() != _plan.input || images[k].channels() != _plan.channels)
+            plan(images[k].size(), images[k].channels(), _plan);
+        forward(images[k], _output, _plan, _arena, 1, &_ranges);
+    }
+
+    for (size_t l = 0; l < _layers.size(); l++)
+    {
+        CNNLayer &layer = _layers[l];
+        if (layer.type != CNNOpType::CONV && layer.type != CNNOpType::FC)
+            continue;
+        // Layers over fewer input channels than one dot product consumes
+        // (the first layer on the image) have too little work per pixel for
+        // int8 to pay off and stay in float.
+        if (layer.params.at(CNNStringParam::KernelD) < Quant::GROUP)
+            continue;
+        const Quant::Activation activation = Quant::activation(_ranges[l][0], _ranges[l][1]);
+        layer.setParam(CNNStringParam::QuantScale, activation.scale);
+        layer.setParam(CNNStringParam::QuantZero, activation.zero);
+        layer.setParam(CNNStringParam::Algorithm, CNNConvAlgo::INT8);
+        layer.prepare();
+    }
+    compile();
+}
+
 string CNN::generateLayerName(const string &type)
 {
     size_t layerN = _layers.size();
@@ -252,6 +1152,18 @@ CNNLayer& CNN::getLayer(const string &name)
     return _layers[_map.at(name)];
 }
 
+const CNNLayer& CNN::getLayer(size_t index) const
+{
+    return _layers[_map.at(_network.at(index))];
+}
+
+void CNN::setHead(int head)
+{
+    if (!_network.empty() && getLayer(_network.back()).type == CNNOpType::SOFTMAX)
+        getLayer(_network.back()).setParam(CNNStringParam::Head, head);
+    compile();
+}
+
 CNNLayer& CNN::addLayer(const CNNLayer &layer)
 {
     size_t layerN = _layers.size();
@@ -259,7 +1171,9 @@ CNNLayer& CNN::addLayer(const CNNLayer &layer)
     
     _map[name] = layerN;
     _layers.push_back(layer);
+    _layers.back().prepare();
     _network.push_back(name);
+    compile();
     return _layers[_map.at(name)];
 }
 
@@ -295,6 +1209,9 @@ void CNN::read(istream &f)
     cv::readB(f, _layers);
     cv::readB(f, _network);
     cv::readB(f, _map);
+    for (size_t i = 0; i < _layers.size(); i++)
+        _layers[i].prepare();
+    compile();
 }
 
 void CNN::read(const FileNode &node)
@@ -302,6 +1219,7 @@ void CNN::read(const FileNode &node)
     _layers.clear();
     _map.clear();
     _network.clear();
+    _steps.clear();
     _name = (string)node[CNNLabel::NAME];
     FileNode n = node[CNNLabel::LAYERS];
     if (n.type() == FileNode::SEQ)
@@ -316,98 +1234,807 @@ void CNN::read(const FileNode &node)
     }
 }
 
-ostream& cnn::operator<<(ostream &out, const CNNLayer& w)
+ostream& cnn::operator<<(ostream &out, const CNNLayer& w)
+{
+    out << "{ "<< endl;
+    out << "\t" << CNNLabel::TYPE << ": " << w.type << endl;
+    if (w.bias.size())
+    {
+        cout << "\t" << CNNLabel::BIAS << ": (" << w.bias.size() << ") [" << w.bias;
+        out << "]" << endl;
+    }
+    if (w.weights.size())
+    {
+        cout << "\t" << CNNLabel::WEIGHTS << ": ("<< w.weights.size() << ") ["<< endl;
+        for (size_t i = 0; i < w.weights.size(); i++)
+        {
+            out << "\t\t" << w.weights[i].rows<< "x" << w.weights[i].cols;
+            if (w.weights[i].channels() > 1)
+                out << "x" << w.weights[i].channels() << " ";
+            out << w.weights[i].reshape(1,1) << endl;
+        }
+        out << "\t]" << endl;
+    }
+    if (w.params.size())
+    {
+        out << "\t" << CNNLabel::PARAMS << "[" << w.params << "]" << endl;
+    }
+    out << "}" << endl;
+    
+    return out;
+}
+
+ostream& cnn::operator<<(ostream &out, const CNN& w)
+{
+    cout << CNNLabel::NAME    << ": \t\t"<< w._name << endl;
+    cout << CNNLabel::NETWORK << ": \t"  << w._network << endl;
+    cout << CNNLabel::LAYERS  << ": \t[" << w._layers << "]" << endl;
+    return out;
+}
+
+void Op::bgr2yuv(const Mat &input, Mat &output)
+{
+    vector<Mat> bgr;
+    split(input, bgr);
+    vector<Mat> yuv(3);
+    for (size_t i = 0; i < yuv.size(); i++)
+        yuv[i].create(bgr[i].size(), CV_32F);
+
+        yuv[0] = 0.299   * bgr[2] + 0.587   * bgr[1] + 0.114   * bgr[0];
+        yuv[1] = -0.14713* bgr[2] - 0.28886 * bgr[1] + 0.436   * bgr[0];
+        yuv[2] = 0.615   * bgr[2] - 0.51499 * bgr[1] - 0.10001 * bgr[0];
+
+        merge(yuv, output);
+
+}
+void Op::CONV(const vector<Mat> &input,
+              const vector<Mat> &weights,
+              vector<Mat> &output,
+              const vector<float> &bias,
+              const int nLayers,
+              const int kernelDepth,
+              const int strideH,
+              const int strideV,
+              const int paddH,
+              const int paddV)
+{
+    output.resize(nLayers);
+    vector<Mat> _conv(kernelDepth);
+    
+    for (size_t i = 0, _inputIdx = 0, _layersInput = 0; i < weights.size(); i++, _inputIdx++)
+    {
+        
+        
+
+        conv(input[_inputIdx], weights[i], _conv[_inputIdx],
+             0, strideH, strideV, paddH, paddV);
+        
+        if (_inputIdx == (kernelDepth - 1))
+        {
+            output[_layersInput].create(_conv[0].size(), CV_32F);
+            _conv[0].copyTo(output[_layersInput]);
+            
+            for (size_t k = 1; k < _conv.size(); k++)
+            {
+                output[_layersInput] += _conv[k];
+            }
+            output[_layersInput] += bias[_layersInput];
+            _layersInput++;
+            
+            _inputIdx = -1;
+        }
+        
+    }
+    
+}
+
+void Op::CONV(const Tensor &input,
+              const vector<Mat> &weights,
+              Tensor &output,
+              const vector<float> &bias,
+              const int nLayers,
+              const int kernelD,
+              const int strideW,
+              const int strideH,
+              const int paddW,
+              const int paddH)
+{
+    vector<Mat> _input, _output;
+    input.toPlanes(_input);
+    CONV(_input, weights, _output, bias, nLayers, kernelD, strideW, strideH, paddW, paddH);
+    output.fromPlanes(_output);
+}
+
+void Op::FC(const Tensor &input,
+            const vector<Mat> &weights,
+            const vector<float> &bias,
+            Tensor &output,
+            size_t outputs)
+{
+    vector<Mat> _input, _output;
+    input.toPlanes(_input);
+    FC(_input, weights, bias, _output, outputs);
+    output.fromPlanes(_output);
+}
+
+void Op::FC_GEMV(const Tensor &input,
+                 const Mat &weightMatrix,
+                 const vector<float> &bias,
+                 Tensor &output,
+                 const int nLayers,
+                 const bool relu,
+                 const int weightFormat,
+                 Arena *scratch,
+                 int parts)
+{
+    const int pixels = input.rows() * input.cols();
+    const int lanes  = input.lanes();
+    const int K      = input.channels() * pixels;
+    CV_Assert(weightMatrix.rows == nLayers && weightMatrix.cols == K);
+
+    Arena _local;
+    Arena &arena      = scratch ? *scratch : _local;
+    const size_t mark = arena.mark();
+
+    // Flatten to the (channel, y, x) order of the matrix rows.
+    float *_x = arena.allocate<float>(K);
+    for (int c = 0; c < input.channels(); c++)
+    {
+        const float *src = input.ptr(c / Tensor::BLOCK) + c % Tensor::BLOCK;
+        float *dst       = &_x[c * pixels];
+        for (int p = 0; p < pixels; p++)
+            dst[p] = src[p * lanes];
+    }
+
+    // Ranges of whole blocks of output channels.
+    float *_y = arena.allocate<float>(nLayers);
+    std::copy(bias.begin(), bias.begin() + nLayers, _y);
+    const int blocks = (nLayers + Tensor::BLOCK - 1) / Tensor::BLOCK;
+    parts = std::min(parts, blocks);
+    Parallel::run(parts, [&](int part, Arena&)
+    {
+        const int m0 = std::min(blocks * part / parts * Tensor::BLOCK, nLayers);
+        const int m1 = std::min(blocks * (part + 1) / parts * Tensor::BLOCK, nLayers);
+        if (weightMatrix.depth() == CV_16U)
+            Gemm::hgemv(m1 - m0, K, weightMatrix.ptr<uint16_t>(m0), weightMatrix.step1(), weightFormat, &_x[0], &_y[m0]);
+        else
+            Gemm::sgemv(m1 - m0, K, weightMatrix.ptr<float>(m0), weightMatrix.step1(), &_x[0], &_y[m0]);
+    }, arena);
+
+    output.create(nLayers, 1, 1);
+    for (int b = 0; b < output.blocks(); b++)
+        for (int l = 0; l < output.lanes(); l++)
+        {
+            const int m = b * Tensor::BLOCK + l;
+            const float value = (m < nLayers) ? _y[m] : 0.f;
+            output.ptr(b)[l] = relu ? std::max(value, 0.f) : value;
+        }
+    arena.release(mark);
+}
+
+size_t Op::fcGemmScratch(int nLayers, int K, int batch)
+{
+    return Arena::align(static_cast<size_t>(K) * batch * sizeof(float)) +
+           Arena::align(Gemm::packedBSize(K, batch) * sizeof(float)) +
+           Arena::align(static_cast<size_t>(nLayers) * batch * sizeof(float));
+}
+
+void Op::FC_GEMM(const vector<Tensor> &inputs,
+                 const Mat &packedWeights,
+                 const vector<float> &bias,
+                 vector<Tensor> &outputs,
+                 const int nLayers,
+                 const bool relu,
+                 Arena *scratch,
+                 int parts)
+{
+    const int N      = static_cast<int>(inputs.size());
+    const int pixels = inputs[0].rows() * inputs[0].cols();
+    const int lanes  = inputs[0].lanes();
+    const int K      = inputs[0].channels() * pixels;
+    const int Mr     = Gemm::roundUp(nLayers, Gemm::MR);
+    CV_Assert(outputs.size() == inputs.size() && !packedWeights.empty());
+
+    Arena _local;
+    Arena &arena      = scratch ? *scratch : _local;
+    const size_t mark = arena.mark();
+
+    // B[K x N]: input n flattened to the (channel, y, x) order of the weight
+    // rows in column n, then packed whole, one KC block after the other.
+    float *_b = arena.allocate<float>(static_cast<size_t>(K) * N);
+    for (int n = 0; n < N; n++)
+    {
+        const Tensor &input = inputs[n];
+        for (int c = 0; c < input.channels(); c++)
+        {
+            const float *src = input.ptr(c / Tensor::BLOCK) + c % Tensor::BLOCK;
+            float *dst       = _b + static_cast<size_t>(c) * pixels * N + n;
+            for (int p = 0; p < pixels; p++)
+                dst[static_cast<size_t>(p) * N] = src[p * lanes];
+        }
+    }
+    float *_packed = arena.allocate<float>(Gemm::packedBSize(K, N));
+    for (int pc = 0; pc < K; pc += Gemm::KC)
+    {
+        const int kc = std::min<int>(Gemm::KC, K - pc);
+        Gemm::packB(kc, N, _b + static_cast<size_t>(pc) * N, N, _packed + Gemm::packedBSize(pc, N));
+    }
+
+    float *_c = arena.allocate<float>(static_cast<size_t>(nLayers) * N);
+    for (int m = 0; m < nLayers; m++)
+        std::fill(_c + static_cast<size_t>(m) * N, _c + static_cast<size_t>(m + 1) * N, bias[m]);
+
+    // Ranges of MR-aligned output channels, which share the packed B.
+    const float *_weights = packedWeights.ptr<float>();
+    const int panels = (nLayers + Gemm::MR - 1) / Gemm::MR;
+    parts = std::min(parts, panels);
+    Parallel::run(parts, [&](int part, Arena&)
+    {
+        const int m0 = std::min(panels * part / parts * Gemm::MR, nLayers);
+        const int m1 = std::min(panels * (part + 1) / parts * Gemm::MR, nLayers);
+        if (m0 == m1)
+            return;
+        for (int pc = 0; pc < K; pc += Gemm::KC)
+        {
+            const int kc = std::min<int>(Gemm::KC, K - pc);
+            Gemm::macroKernel(m1 - m0, N, kc,
+                              _weights + static_cast<size_t>(Mr) * pc + static_cast<size_t>(m0) * kc,
+                              _packed + Gemm::packedBSize(pc, N),
+                              _c + static_cast<size_t>(m0) * N, N, true);
+        }
+    }, arena);
+
+    for (int n = 0; n < N; n++)
+    {
+        Tensor &output = outputs[n];
+        output.create(nLayers, 1, 1);
+        for (int b = 0; b < output.blocks(); b++)
+            for (int l = 0; l < output.lanes(); l++)
+            {
+                const int m = b * Tensor::BLOCK + l;
+                const float value = (m < nLayers) ? _c[static_cast<size_t>(m) * N + n] : 0.f;
+                output.ptr(b)[l] = relu ? std::max(value, 0.f) : value;
+            }
+    }
+    arena.release(mark);
+}
+
+void Op::CONV_GEMM(const Tensor &input,
+                   const Mat &packedWeights,
+                   Tensor &output,
+                   const vector<float> &bias,
+                   const int nLayers,
+                   const int kernelD,
+                   const int kernelW,
+                   const int kernelH,
+                   const int strideW,
+                   const int strideH,
+                   const int paddW,
+                   const int paddH,
+                   Arena *scratch,
+                   int parts)
+{
+    const int outputW = ((input.cols() + 2 * paddW - kernelW) / strideW) + 1;
+    const int outputH = ((input.rows() + 2 * paddH - kernelH) / strideH) + 1;
+    const int N       = outputW * outputH;
+    const int K       = kernelD * kernelW * kernelH;
+    const int Mr      = Gemm::roundUp(nLayers, Gemm::MR);
+
+    Arena _local;
+    Arena &arena      = scratch ? *scratch : _local;
+    const size_t mark = arena.mark();
+
+    float *_output = arena.allocate<float>(static_cast<size_t>(nLayers) * N);
+    for (int m = 0; m < nLayers; m++)
+    {
+        float *row = _output + static_cast<size_t>(m) * N;
+        std::fill(row, row + N, bias[m]);
+    }
+
+    // Ranges of columns (output pixels), NR-aligned, each with its own
+    // packed B.
+    const float *_weights = packedWeights.ptr<float>();
+    const int panels = (N + Gemm::NR - 1) / Gemm::NR;
+    parts = std::min(parts, panels);
+    Parallel::run(parts, [&](int part, Arena &_scratch)
+    {
+        const int j0 = std::min(panels * part / parts * Gemm::NR, N);
+        const int j1 = std::min(panels * (part + 1) / parts * Gemm::NR, N);
+        const size_t mark = _scratch.mark();
+        float *_packed = _scratch.allocate<float>(Gemm::packedBSize(std::min<int>(Gemm::KC, K), std::min<int>(Gemm::NC, N)));
+        for (int jc = j0; jc < j1; jc += Gemm::NC)
+        {
+            const int nc = std::min<int>(Gemm::NC, j1 - jc);
+            for (int pc = 0; pc < K; pc += Gemm::KC)
+            {
+                const int kc = std::min<int>(Gemm::KC, K - pc);
+                im2col(input, _packed, kernelW, kernelH, strideW, strideH,
+                       paddW, paddH, outputW, pc, kc, jc, nc);
+                Gemm::macroKernel(nLayers, nc, kc,
+                                  _weights + static_cast<size_t>(Mr) * pc,
+                                  _packed,
+                                  _output + jc, N, true);
+            }
+        }
+        _scratch.release(mark);
+    }, arena);
+
+    // C is one row per layer; interleave it into blocks.
+    output.create(nLayers, outputH, outputW);
+    const int lanes = output.lanes();
+    for (int b = 0; b < output.blocks(); b++)
+    {
+        float *dst = output.ptr(b);
+        for (int l = 0; l < lanes; l++)
+        {
+            const int m = b * Tensor::BLOCK + l;
+            const float *src = (m < nLayers) ? _output + static_cast<size_t>(m) * N : nullptr;
+            for (int p = 0; p < N; p++)
+                dst[p * lanes + l] = src ? src[p] : 0.f;
+        }
+    }
+    arena.release(mark);
+}
+
+void Op::CONV_DIRECT(const Tensor &input,
+                     const Mat &blockedWeights,
+                     Tensor &output,
+                     const vector<float> &bias,
+                     const int nLayers,
+                     const int kernelD,
+                     const int kernelW,
+                     const int kernelH,
+                     const int strideW,
+                     const int strideH,
+                     const int paddW,
+                     const int paddH,
+                     const bool relu,
+                     const int weightFormat,
+                     Arena *scratch,
+                     int parts)
 {
-    out << "{ "<< endl;
-    out << "\t" << CNNLabel::TYPE << ": " << w.type << endl;
-    if (w.bias.size())
+    Direct::Kernel kernel = Direct::kernel(kernelW, kernelH, strideW, strideH, weightFormat);
+    CV_Assert(kernel != nullptr);
+
+    Arena _local;
+    Arena &arena      = scratch ? *scratch : _local;
+    const size_t mark = arena.mark();
+
+    // The kernels expect an unpadded input.
+    Tensor _input;
+    if (paddW || paddH)
     {
-        cout << "\t" << CNNLabel::BIAS << ": (" << w.bias.size() << ") [" << w.bias;
-        out << "]" << endl;
+        _input.create(input.channels(), input.rows() + 2 * paddH, input.cols() + 2 * paddW, arena);
+        input.pad(_input, paddW, paddH);
     }
-    if (w.weights.size())
+    else
+        _input = input;
+
+    const int outputW = ((_input.cols() - kernelW) / strideW) + 1;
+    const int outputH = ((_input.rows() - kernelH) / strideH) + 1;
+
+    // Row bands of the output, each from the input rows it covers.
+    output.create(nLayers, outputH, outputW);
+    parts = std::min(parts, outputH);
+    Parallel::run(parts, [&](int part, Arena&)
     {
-        cout << "\t" << CNNLabel::WEIGHTS << ": ("<< w.weights.size() << ") ["<< endl;
-        for (size_t i = 0; i < w.weights.size(); i++)
-        {
-            out << "\t\t" << w.weights[i].rows<< "x" << w.weights[i].cols;
-            if (w.weights[i].channels() > 1)
-                out << "x" << w.weights[i].channels() << " ";
-            out << w.weights[i].reshape(1,1) << endl;
-        }
-        out << "\t]" << endl;
-    }
-    if (w.params.size())
+        const int y0 = outputH * part / parts;
+        const int y1 = outputH * (part + 1) / parts;
+        Tensor _band = output.rowRange(y0, y1);
+        kernel(_input.rowRange(y0 * strideH, (y1 - 1) * strideH + kernelH),
+               blockedWeights.ptr(), &bias[0], _band, kernelD, relu);
+    }, arena);
+    arena.release(mark);
+}
+
+void Op::CONV_POOL(const Tensor &input,
+                   const Mat &blockedWeights,
+                   Tensor &output,
+                   const vector<float> &bias,
+                   const int nLayers,
+                   const int kernelD,
+                   const int kernelW,
+                   const int kernelH,
+                   const int strideW,
+                   const int strideH,
+                   const int paddW,
+                   const int paddH,
+                   const int poolW,
+                   const int poolH,
+                   const int poolStrideW,
+                   const int poolStrideH,
+                   const int poolPaddW,
+                   const int poolPaddH,
+                   const bool relu,
+                   const int weightFormat,
+                   Arena *scratch,
+                   int parts)
+{
+    Direct::PooledKernel kernel = Direct::pooled(kernelW, kernelH, strideW, strideH, weightFormat);
+    CV_Assert(kernel != nullptr);
+
+    Arena _local;
+    Arena &arena      = scratch ? *scratch : _local;
+    const size_t mark = arena.mark();
+
+    Tensor _input;
+    if (paddW || paddH)
     {
-        out << "\t" << CNNLabel::PARAMS << "[" << w.params << "]" << endl;
+        _input.create(input.channels(), input.rows() + 2 * paddH, input.cols() + 2 * paddW, arena);
+        input.pad(_input, paddW, paddH);
     }
-    out << "}" << endl;
-    
-    return out;
+    else
+        _input = input;
+
+    const int convW   = ((_input.cols() - kernelW) / strideW) + 1;
+    const int convH   = ((_input.rows() - kernelH) / strideH) + 1;
+    const int outputW = ((convW + 2 * poolPaddW - poolW) / poolStrideW) + 1;
+    const int outputH = ((convH + 2 * poolPaddH - poolH) / poolStrideH) + 1;
+
+    // Row bands of the pooled output, each from the convolution rows its
+    // windows cover.
+    const Direct::Pool pool = {poolW, poolH, poolStrideW, poolStrideH, poolPaddW, poolPaddH};
+    output.create(nLayers, outputH, outputW);
+    parts = std::min(parts, outputH);
+    Parallel::run(parts, [&](int part, Arena &_scratch)
+    {
+        const int y0 = outputH * part / parts;
+        const int y1 = outputH * (part + 1) / parts;
+        int c0, c1;
+        Direct::Pool band;
+        MaxPool::band(pool, convH, y0, y1, c0, c1, band);
+        Tensor _band = output.rowRange(y0, y1);
+        kernel(_input.rowRange(c0 * strideH, (c1 - 1) * strideH + kernelH),
+               blockedWeights.ptr(), &bias[0], _band, kernelD, band, relu, _scratch);
+    }, arena);
+    arena.release(mark);
 }
 
-ostream& cnn::operator<<(ostream &out, const CNN& w)
+void Op::CONV_WINOGRAD(const Tensor &input,
+                       const Mat &transformedWeights,
+                       Tensor &output,
+                       const vector<float> &bias,
+                       const int nLayers,
+                       const int kernelD,
+                       const int paddW,
+                       const int paddH,
+                       const int tile,
+                       const bool relu,
+                       Arena *scratch,
+                       int parts)
 {
-    cout << CNNLabel::NAME    << ": \t\t"<< w._name << endl;
-    cout << CNNLabel::NETWORK << ": \t"  << w._network << endl;
-    cout << CNNLabel::LAYERS  << ": \t[" << w._layers << "]" << endl;
-    return out;
+    CV_Assert(input.lanes() == Tensor::BLOCK);
+
+    const int BLOCK    = Tensor::BLOCK;
+    const int rows     = input.rows();
+    const int cols     = input.cols();
+    const int outputW  = cols + 2 * paddW - 2;
+    const int outputH  = rows + 2 * paddH - 2;
+    const int alpha    = Winograd::alpha(tile);
+    const int elements = alpha * alpha;
+    const int tilesX   = (outputW + tile - 1) / tile;
+    const int tilesY   = (outputH + tile - 1) / tile;
+    const int tiles    = tilesX * tilesY;
+    const int chunk    = std::min<int>(tiles, WINOGRAD_CHUNK);
+    const int blocksD  = input.blocks();
+    const size_t block = Direct::blockedSize(nLayers, kernelD);
+
+    // V[e] holds the transformed input tiles of a chunk as a kernelD channel,
+    // one row per element tensor; the products M[e] = U[e] V[e] are a 1x1
+    // convolution of each row, computed to whole blocks of layers. Parts
+    // are ranges of chunks, each with its own V and M.
+    Arena _local;
+    Arena &arena = scratch ? *scratch : _local;
+
+    Direct::Kernel product = Direct::kernel(1, 1, 1, 1);
+    output.create(nLayers, outputH, outputW);
+    const int lanes  = output.lanes();
+    const int chunks = (tiles + chunk - 1) / chunk;
+    parts = std::min(parts, chunks);
+
+    Parallel::run(parts, [&](int part, Arena &_scratch)
+    {
+        const size_t mark = _scratch.mark();
+        Tensor _v, _m;
+        _v.create(kernelD, elements, chunk, _scratch);
+        _m.create(Gemm::roundUp(nLayers, BLOCK), elements, chunk, _scratch);
+        float _d[6 * 6 * Tensor::BLOCK], _y[4 * 4 * Tensor::BLOCK];
+
+        const int end = chunks * (part + 1) / parts * chunk;
+        for (int t0 = chunks * part / parts * chunk; t0 < end; t0 += chunk)
+        {
+            const int nt = std::min(chunk, tiles - t0);
+            if (nt != _v.cols())
+            {
+                // The last chunk is smaller and fits in the same memory.
+                _v.create(kernelD, elements, nt, _v.ptr());
+                _m.create(_m.channels(), elements, nt, _m.ptr());
+            }
+
+            for (int t = 0; t < nt; t++)
+            {
+                const int y0 = ((t0 + t) / tilesX) * tile - paddH;
+                const int x0 = ((t0 + t) % tilesX) * tile - paddW;
+                const bool inside = y0 >= 0 && x0 >= 0 && y0 + alpha <= rows && x0 + alpha <= cols;
+                for (int b = 0; b < blocksD; b++)
+                {
+                    if (inside)
+                    {
+                        Winograd::transformInput(tile, input.ptr(b, y0) + x0 * BLOCK, input.rowStep(),
+                                                 _v.ptr(b) + t * BLOCK, _v.rowStep());
+                        continue;
+                    }
+                    for (int r = 0; r < alpha; r++)
+                        for (int c = 0; c < alpha; c++)
+                        {
+                            const int y = y0 + r;
+                            const int x = x0 + c;
+                            float *dst  = &_d[(r * alpha + c) * BLOCK];
+                            if (y >= 0 && y < rows && x >= 0 && x < cols)
+                                memcpy(dst, input.ptr(b, y) + x * BLOCK, BLOCK * sizeof(float));
+                            else
+                                memset(dst, 0, BLOCK * sizeof(float));
+                        }
+                    Winograd::transformInput(tile, _d, alpha * BLOCK, _v.ptr(b) + t * BLOCK, _v.rowStep());
+                }
+            }
+
+            for (int e = 0; e < elements; e++)
+            {
+                Tensor _me = _m.rowRange(e, e + 1);
+                product(_v.rowRange(e, e + 1), transformedWeights.ptr<float>() + e * block,
+                        nullptr, _me, kernelD, false);
+            }
+
+            for (int b = 0; b < output.blocks(); b++)
+            {
+                const int c0 = b * BLOCK;
+                const simd::v8f _bias = (nLayers - c0 >= BLOCK) ? simd::load(&bias[c0]) :
+                                        simd::loadPartial(&bias[c0], nLayers - c0);
+                for (int t = 0; t < nt; t++)
+                {
+                    Winograd::transformOutput(tile, _m.ptr(b) + t * BLOCK, _m.rowStep(), _y);
+                    const int y0 = ((t0 + t) / tilesX) * tile;
+                    const int x0 = ((t0 + t) % tilesX) * tile;
+                    const int h  = std::min(tile, outputH - y0);
+                    const int w  = std::min(tile, outputW - x0);
+                    for (int r = 0; r < h; r++)
+                    {
+                        float *out = output.ptr(b, y0 + r) + x0 * lanes;
+                        for (int c = 0; c < w; c++, out += lanes)
+                        {
+                            simd::v8f value = simd::add(simd::load(&_y[(r * tile + c) * BLOCK]), _bias);
+                            if (relu)
+                                value = simd::max(value, simd::zero());
+                            if (lanes == BLOCK)
+                                simd::store(out, value);
+                            else
+                                simd::storePartial(out, value, lanes);
+                        }
+                    }
+                }
+            }
+        }
+        _scratch.release(mark);
+    }, arena);
 }
 
-void Op::bgr2yuv(const Mat &input, Mat &output)
+void Op::CONV_INT8(const Tensor &input,
+                   const Mat &quantizedWeights,
+                   const vector<float> &weightScales,
+                   const vector<int32_t> &weightSums,
+                   Tensor &output,
+                   const vector<float> &bias,
+                   const int nLayers,
+                   const int kernelD,
+                   const int kernelW,
+                   const int kernelH,
+                   const int strideW,
+                   const int strideH,
+                   const int paddW,
+                   const int paddH,
+                   const Quant::Activation &activation,
+                   const bool relu,
+                   Arena *scratch,
+                   int parts)
 {
-    vector<Mat> bgr;
-    split(input, bgr);
-    vector<Mat> yuv(3);
-    for (size_t i = 0; i < yuv.size(); i++)
-        yuv[i].create(bgr[i].size(), CV_32F);
+    const int outputW = ((input.cols() + 2 * paddW - kernelW) / strideW) + 1;
+    const int outputH = ((input.rows() + 2 * paddH - kernelH) / strideH) + 1;
+    const int K       = kernelD * kernelW * kernelH;
+    const size_t row  = Quant::rowSize(K);
+    const int lanes   = input.lanes();
+
+    Arena _local;
+    Arena &arena      = scratch ? *scratch : _local;
+    const size_t mark = arena.mark();
+
+    // Codes of the padded input, channels innermost: [y][x][kernelD]. The
+    // border holds the code of 0.
+    const int paddedW   = input.cols() + 2 * paddW;
+    const int paddedH   = input.rows() + 2 * paddH;
+    const size_t nCodes = static_cast<size_t>(paddedW) * paddedH * kernelD;
+    uint8_t *_codes     = arena.allocate<uint8_t>(nCodes);
+    uint8_t *_row       = arena.allocate<uint8_t>(input.rowStep());
+    memset(_codes, activation.zero, nCodes);
+    for (int b = 0; b < input.blocks(); b++)
+    {
+        const int n = std::min(lanes, kernelD - b * Tensor::BLOCK);
+        for (int y = 0; y < input.rows(); y++)
+        {
+            Quant::quantize(input.ptr(b, y), input.rowStep(), activation, &_row[0]);
+            uint8_t *dst = &_codes[((static_cast<size_t>(y) + paddH) * paddedW + paddW) * kernelD + b * Tensor::BLOCK];
+            for (int x = 0; x < input.cols(); x++)
+                memcpy(dst + x * kernelD, &_row[x * lanes], n);
+        }
+    }
 
-        yuv[0] = 0.299   * bgr[2] + 0.587   * bgr[1] + 0.114   * bgr[0];
-        yuv[1] = -0.14713* bgr[2] - 0.28886 * bgr[1] + 0.436   * bgr[0];
-        yuv[2] = 0.615   * bgr[2] - 0.51499 * bgr[1] - 0.10001 * bgr[0];
+    // Dequantization per output channel, zero for the padding channels.
+    const int CHUNK       = INT8_CHUNK;
+    const size_t accRow   = Gemm::roundUp(nLayers, Quant::BLOCK);
+    const int N           = outputW * outputH;
+    float   *_scale  = arena.allocate<float>(accRow);
+    float   *_offset = arena.allocate<float>(accRow);
+    std::fill(_scale, _scale + accRow, 0.f);
+    std::fill(_offset, _offset + accRow, 0.f);
+    for (int m = 0; m < nLayers; m++)
+    {
+        _scale[m]  = activation.scale * weightScales[m];
+        _offset[m] = bias[m] - _scale[m] * activation.zero * weightSums[m];
+    }
 
-        merge(yuv, output);
+    // im2col codes and int32 sums of CHUNK output pixels at a time; parts
+    // are ranges of chunks, each with its own.
+    output.create(nLayers, outputH, outputW);
+    const int outputLanes = output.lanes();
+    const int chunks      = (N + CHUNK - 1) / CHUNK;
+    parts = std::min(parts, chunks);
+    Parallel::run(parts, [&](int part, Arena &_scratch)
+    {
+        const size_t mark = _scratch.mark();
+        uint8_t *_cols = _scratch.allocate<uint8_t>(CHUNK * row);
+        int32_t *_acc  = _scratch.allocate<int32_t>(CHUNK * accRow);
+        memset(_cols, 0, CHUNK * row);
+
+        const int end = std::min(chunks * (part + 1) / parts * CHUNK, N);
+        for (int n0 = chunks * part / parts * CHUNK; n0 < end; n0 += CHUNK)
+        {
+            const int nc = std::min(CHUNK, N - n0);
+            for (int n = 0; n < nc; n++)
+            {
+                const int oy = (n0 + n) / outputW;
+                const int ox = (n0 + n) % outputW;
+                uint8_t *dst = &_cols[n * row];
+                for (int ky = 0; ky < kernelH; ky++)
+                {
+                    const uint8_t *src = &_codes[((static_cast<size_t>(oy) * strideH + ky) * paddedW + ox * strideW) * kernelD];
+                    memcpy(dst + ky * kernelW * kernelD, src, kernelW * kernelD);
+                }
+            }
+            Quant::gemm(nLayers, nc, K, &_cols[0], quantizedWeights.ptr<int8_t>(), &_acc[0], accRow);
 
+            for (int n = 0; n < nc; n++)
+                for (int b = 0; b < output.blocks(); b++)
+                    Quant::dequantize(&_acc[n * accRow + b * Tensor::BLOCK], outputLanes,
+                                      &_scale[b * Tensor::BLOCK], &_offset[b * Tensor::BLOCK], relu,
+                                      output.ptr(b) + static_cast<size_t>(n0 + n) * outputLanes);
+        }
+        _scratch.release(mark);
+    }, arena);
+    arena.release(mark);
 }
-void Op::CONV(const vector<Mat> &input,
-              const vector<Mat> &weights,
-              vector<Mat> &output,
-              const vector<float> &bias,
-              const int nLayers,
-              const int kernelDepth,
-              const int strideH,
-              const int strideV,
-              const int paddH,
-              const int paddV)
+
+void Op::im2col(const Tensor &input,
+                float *packed,
+                int kernelW,
+                int kernelH,
+                int strideW,
+                int strideH,
+                int paddW,
+                int paddH,
+                int outputW,
+                int k0, int kc,
+                int n0, int nc)
 {
-    output.resize(nLayers);
-    vector<Mat> _conv(kernelDepth);
-    
-    for (size_t i = 0, _inputIdx = 0, _layersInput = 0; i < weights.size(); i++, _inputIdx++)
-    {
-        
-        
+    const int rows  = input.rows();
+    const int cols  = input.cols();
+    const int lanes = input.lanes();
+    const size_t rowStep = input.rowStep();
+    int _y[Gemm::NR], _x[Gemm::NR];
 
-        conv(input[_inputIdx], weights[i], _conv[_inputIdx],
-             0, strideH, strideV, paddH, paddV);
-        
-        if (_inputIdx == (kernelDepth - 1))
+    for (int jr = 0; jr < nc; jr += Gemm::NR)
+    {
+        const int nr = std::min<int>(Gemm::NR, nc - jr);
+        for (int j = 0; j < nr; j++)
         {
-            output[_layersInput].create(_conv[0].size(), CV_32F);
-            _conv[0].copyTo(output[_layersInput]);
-            
-            for (size_t k = 1; k < _conv.size(); k++)
+            _y[j] = ((n0 + jr + j) / outputW) * strideH - paddH;
+            _x[j] = ((n0 + jr + j) % outputW) * strideW - paddW;
+        }
+        // The whole panel reads one run of an input row when its pixels
+        // share an output row and the stride is 1.
+        const bool sameRow = (strideW == 1) && (_y[nr - 1] == _y[0]);
+
+        int kx = k0 % kernelW;
+        int ky = (k0 / kernelW) % kernelH;
+        int kd = k0 / (kernelW * kernelH);
+        for (int k = 0; k < kc; k++, packed += Gemm::NR)
+        {
+            const float *plane = input.ptr(kd / Tensor::BLOCK) + kd % Tensor::BLOCK;
+            const int y        = _y[0] + ky;
+            const int x        = _x[0] + kx;
+            if (sameRow && y >= 0 && y < rows && x >= 0 && x + nr <= cols)
             {
-                output[_layersInput] += _conv[k];
+                const float *src = plane + y * rowStep + x * lanes;
+                for (int j = 0; j < nr; j++)
+                    packed[j] = src[j * lanes];
+            }
+            else
+            {
+                for (int j = 0; j < nr; j++)
+                {
+                    const int yy = _y[j] + ky;
+                    const int xx = _x[j] + kx;
+                    packed[j] = (yy >= 0 && yy < rows && xx >= 0 && xx < cols) ?
+                                plane[yy * rowStep + xx * lanes] : 0.f;
+                }
+            }
+            for (int j = nr; j < Gemm::NR; j++)
+                packed[j] = 0.f;
+
+            if (++kx == kernelW)
+            {
+                kx = 0;
+                if (++ky == kernelH)
+                {
+                    ky = 0;
+                    kd++;
+                }
             }
-            output[_layersInput] += bias[_layersInput];
-            _layersInput++;
-            
-            _inputIdx = -1;
         }
-        
     }
-    
+}
+
+void Op::MAX_POOL(const Tensor &input,
+                  Tensor &output,
+                  int width,
+                  int height,
+                  int strideW,
+                  int strideH,
+                  int paddingW,
+                  int paddingH,
+                  Arena *scratch,
+                  int parts)
+{
+    const MaxPool::Window window = { width, height, strideW, strideH, paddingW, paddingH };
+    const int outputW = MaxPool::outputSize(input.cols(), width, strideW, paddingW);
+    const int outputH = MaxPool::outputSize(input.rows(), height, strideH, paddingH);
+
+    Arena _local;
+    output.create(input.channels(), outputH, outputW);
+    parts = std::min(parts, outputH);
+    Parallel::run(parts, [&](int part, Arena &arena)
+    {
+        const int y0 = outputH * part / parts;
+        const int y1 = outputH * (part + 1) / parts;
+        int r0, r1;
+        MaxPool::Window band;
+        MaxPool::band(window, input.rows(), y0, y1, r0, r1, band);
+        for (int b = 0; b < input.blocks(); b++)
+            MaxPool::pool(input.ptr(b, r0), input.rowStep(), r1 - r0, input.cols(), input.lanes(),
+                          band, output.ptr(b, y0), output.rowStep(), outputW, y1 - y0, false, arena);
+    }, scratch ? *scratch : _local);
+}
+
+void Op::RELU(const Tensor &input,
+              Tensor &output)
+{
+    Isa::kernels().relu(input, output);
+}
+
+void Op::SOFTMAX(const Tensor &input,
+                 Tensor &output,
+                 const int head)
+{
+    Isa::kernels().softmax(input, output, head);
 }
 
 void Op::MAX_POOL(const vector<Mat> &input,
@@ -442,30 +2069,22 @@ void Op::FC(const vector<Mat> &input,
 void Op::SOFTMAX(const vector<Mat> &input,
                         vector<Mat> &output)
 {
+    // Plane-wise: every step is one vectorized pass over whole planes.
+    Mat _max = input[0].clone(), _sum;
+    for (size_t k = 1; k < input.size(); k++)
+        cv::max(_max, input[k], _max);
+
     output.resize(input.size());
     for (size_t k = 0; k < input.size(); k++)
     {
-        output[k].create(input[k].size(), input[k].type());
+        cv::exp(input[k] - _max, output[k]);
+        if (k == 0)
+            _sum = output[k].clone();
+        else
+            _sum += output[k];
     }
-    
-    
-    for (size_t r = 0; r < input[0].rows; r++)
-        for (size_t c = 0; c < input[0].cols; c++)
-        {
-            Mat _vector(input.size(), 1, CV_32F), _vectorOutput;
-            
-            for (size_t k = 0; k < input.size(); k++)
-            {
-                _vector.at<float>(k) = input[k].at<float>(r,c);
-            }
-            
-            softmax(_vector, _vectorOutput);
-            
-            for (size_t k = 0; k < input.size(); k++)
-            {
-                output[k].at<float>(r,c) = _vectorOutput.at<float>(k);
-            }
-        }
+    for (size_t k = 0; k < output.size(); k++)
+        cv::divide(output[k], _sum, output[k]);
 }
 
 void Op::RELU(const vector<Mat> &input,
@@ -550,78 +2169,98 @@ void Op::max_pool(const Mat &input,
                   int paddingH,
                   int paddingV)
 {
-    
-    Mat _input;
-    copyMakeBorder(input, _input, paddingV, paddingV,
-                   paddingH, paddingH, BORDER_CONSTANT,
-                   Scalar::all(std::numeric_limits<float>::lowest()));
-    int newWidth = ((_input.cols - width)/strideH) + 1;
-    int newHeight= ((_input.rows - height)/strideV) + 1;
-    output.create(Size(newWidth, newHeight), input.type());
-    
-    for (size_t row = 0, r = 0; row < newHeight; row++, r+=strideV )
-        for (size_t col = 0, c = 0; col < newWidth; col++,  c+= strideH)
-        {
-            double _max;
-            
-            minMaxIdx(_input(Rect(c, r, width, height)), NULL, &_max);
-            
-            output.at<float>(row, col) = static_cast<float>(_max);
-        } 
+    const MaxPool::Window window = { width, height, strideH, strideV, paddingH, paddingV };
+    const int newWidth  = MaxPool::outputSize(input.cols, width, strideH, paddingH);
+    const int newHeight = MaxPool::outputSize(input.rows, height, strideV, paddingV);
+
+    Mat _input = input;
+    if (input.depth() != CV_32F)
+        input.convertTo(_input, CV_32F);
+    Arena _scratch;
+    output.create(Size(newWidth, newHeight), CV_32FC(input.channels()));
+    MaxPool::pool(_input.ptr<float>(), _input.step1(), _input.rows, _input.cols, _input.channels(),
+                  window, output.ptr<float>(), output.step1(), newWidth, newHeight, false, _scratch);
 }
 
 
 
-Detection& cnn::Alg::applyTransformationCode(Detection &detection,
-                                          const Mat &response,
-                                          const float thr)
+// The 45 transforms of the calibration nets: code 9 s + 3 x + y scales a
+// box by calibScales[s] and shifts it by calibOffsets[x] and [y] of its
+// size. calibCodes has the bit masks of the codes of each.
+static const float calibScales[]  = {0.83f, 0.91f, 1.0f, 1.10f, 1.21f};
+static const float calibOffsets[] = {-0.17f, 0.0f, 0.17f};
+
+struct CalibrationCodes
 {
-    struct _coords {
-        size_t s;
-        size_t x;
-        size_t y;
-    };
-    vector<_coords> trans;
+    enum { COUNT = 45 };
 
+    uint64_t s[5];
+    uint64_t x[3];
+    uint64_t y[3];
 
-    for (size_t i = 0; i< response.rows * response.cols ; i++)
+    CalibrationCodes(): s(), x(), y()
     {
-        if (response.at<float>(i) > thr)
+        for (int i = 0; i < COUNT; i++)
         {
-            _coords t = { i / 9 , (i / 3) % 3, i % 3 };
-            trans.push_back(std::move(t));
+            s[i / 9]       |= uint64_t(1) << i;
+            x[(i / 3) % 3] |= uint64_t(1) << i;
+            y[i % 3]       |= uint64_t(1) << i;
         }
     }
+};
+static const CalibrationCodes calibCodes;
 
-    vector<float> s = {0.83f, 0.91f, 1.0f, 1.10f, 1.21f};
-    vector<float> x = {-0.17f, 0.0f, 0.17f};
-    vector<float> y = {-0.17f, 0.0f, 0.17f};
-
-    float ts = 0.f, tx = 0.f, ty = 0.f;
-
-    if (trans.size())
+// Codes whose score is over thr: scores in blocks of Tensor::BLOCK floats,
+// blockStep floats apart.
+static uint64_t calibrationHits(const float *scores, size_t blockStep, float thr)
+{
+    const simd::v8f _thr = simd::set1(thr);
+    uint64_t hits = 0;
+    for (int b = 0; b * Tensor::BLOCK < CalibrationCodes::COUNT; b++)
     {
-        for (size_t i = 0; i < trans.size(); i++)
-        {
-            _coords &_tr = trans[i];
-            ts += s[_tr.s];
-            tx += x[_tr.x];
-            ty += y[_tr.y];
-        }
-
-        ts /= trans.size();
-        tx /= trans.size();
-        ty /= trans.size();
+        const int lanes = std::min<int>(Tensor::BLOCK, CalibrationCodes::COUNT - b * Tensor::BLOCK);
+        const simd::v8f v = (lanes == Tensor::BLOCK) ? simd::load(scores + b * blockStep) :
+                                                       simd::loadPartial(scores + b * blockStep, lanes);
+        hits |= static_cast<uint64_t>(simd::greater(v, _thr) & ((1 << lanes) - 1)) << (b * Tensor::BLOCK);
+    }
+    return hits;
+}
 
-        detection.face.x = detection.face.x - tx * detection.face.width  + (ts - 1) * detection.face.width / 2 / ts;
-        detection.face.y = detection.face.y - ty * detection.face.height + (ts - 1) * detection.face.height / 2 / ts;
+// Moves detection by the mean of the transforms of hits, whose scales and
+// offsets are counted from the masks rather than summed one by one.
+static void applyCalibration(Detection &detection, uint64_t hits)
+{
+    const size_t count = bitset<64>(hits).count();
+    if (count == 0)
+        return;
 
-        detection.face.width  /= ts;
-        detection.face.height /= ts;
+    float ts = 0.f, tx = 0.f, ty = 0.f;
+    for (int i = 0; i < 5; i++)
+        ts += bitset<64>(hits & calibCodes.s[i]).count() * calibScales[i];
+    for (int i = 0; i < 3; i++)
+    {
+        tx += bitset<64>(hits & calibCodes.x[i]).count() * calibOffsets[i];
+        ty += bitset<64>(hits & calibCodes.y[i]).count() * calibOffsets[i];
+    }
+    ts /= count;
+    tx /= count;
+    ty /= count;
 
+    detection.face.x = detection.face.x - tx * detection.face.width  + (ts - 1) * detection.face.width / 2 / ts;
+    detection.face.y = detection.face.y - ty * detection.face.height + (ts - 1) * detection.face.height / 2 / ts;
 
-    }
+    detection.face.width  /= ts;
+    detection.face.height /= ts;
+}
 
+Detection& cnn::Alg::applyTransformationCode(Detection &detection,
+                                          const Mat &response,
+                                          const float thr)
+{
+    CV_Assert(response.isContinuous() && response.total() == CalibrationCodes::COUNT);
+    float _scores[6 * Tensor::BLOCK] = {};
+    std::copy(response.ptr<float>(), response.ptr<float>() + CalibrationCodes::COUNT, _scores);
+    applyCalibration(detection, calibrationHits(_scores, Tensor::BLOCK, thr));
     return detection;
 }
 
@@ -677,11 +2316,64 @@ void cnn::Alg::calibVisualize()
 
 void cnn::Alg::forward(const Mat &img, const cnn::CNN &net, Mat &score, int layer)
 {
+    Workspace _workspace;
     vector<Mat> scores;
-    net.forward(img, scores);
+    net.forward(img, scores, _workspace);
     score = std::move(scores[layer]);
 }
 
+void cnn::Alg::loadSamples(const string &directory, Size size, vector<Mat> &samples)
+{
+    vector<string> files;
+    glob(directory + "/*", files);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        Mat image = imread(files[i], IMREAD_GRAYSCALE), normalized;
+        if (image.empty())
+            continue;
+        image.convertTo(image, CV_32F, 1. / 255.);
+        cnn::Op::normGlobal(image, normalized);
+        if (size.area() > 0)
+            resize(normalized, normalized, size, 0, 0, INTER_AREA);
+        samples.push_back(normalized);
+    }
+}
+
+void cnn::Alg::quantizationDrift(const string &stage,
+                                 const cnn::CNN &reference,
+                                 const cnn::CNN &quantized,
+                                 const vector<Mat> &samples,
+                                 float thr,
+                                 ostream &out)
+{
+    Workspace _workspace;
+    double _max = 0., _sum = 0.;
+    size_t values = 0, scores = 0, flipped = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        vector<Mat> expected, actual;
+        reference.forward(samples[i], expected, _workspace);
+        quantized.forward(samples[i], actual, _workspace);
+        for (size_t k = 0; k < expected.size(); k++)
+        {
+            Mat diff;
+            absdiff(expected[k], actual[k], diff);
+            double m;
+            minMaxIdx(diff, nullptr, &m);
+            _max    = std::max(_max, m);
+            _sum   += sum(diff).val[0];
+            values += diff.total();
+        }
+        for (int r = 0; r < expected[0].rows; r++)
+            for (int c = 0; c < expected[0].cols; c++, scores++)
+                if ((expected[0].at<float>(r, c) > thr) != (actual[0].at<float>(r, c) > thr))
+                    flipped++;
+    }
+    out << stage << ": " << samples.size() << " samples, max |diff| " << _max
+        << ", mean |diff| " << (values ? _sum / values : 0.)
+        << ", " << flipped << "/" << scores << " decisions flipped at " << thr << endl;
+}
+
 void cnn::Alg::heatMapFromScore(const Mat &score, Mat &heatmap, cv::Size size)
 {
     if (size.width == 0 && size.height == 0)
@@ -730,61 +2422,318 @@ void cnn::Alg::calibResults(const vector<Mat> &scores, Mat &results)
 }
 
 
+template<class Net, class CalibNet>
 void cnn::Alg::forwardDetection(const Mat &image,
                              const vector<Detection> &detections,
-                             const cnn::CNN &net,
-                             const cnn::CNN &calibNet,
+                             const Net &net,
+                             const CalibNet &calibNet,
                              const cnn::CNNParam &params,
                              vector<Detection> &outputs,
                              float thr, float calibThr, bool useCalibration)
 {
+    CV_Assert(image.type() == CV_32FC1);
 
-    vector<Mat> score;
+    // Every crop resized into one buffer, KernelH x KernelW floats each,
+    // the batch of net. Its survivors are moved to the front for calibNet.
+    const Size size(params.KernelW, params.KernelH);
+    const size_t crop = static_cast<size_t>(size.area());
     Rect imgRoi(0,0,image.cols, image.rows);
+    vector<size_t> candidates;
+    for (size_t i = 0; i < detections.size(); i++)
+        if ((detections[i].face & imgRoi).area() > 0)
+            candidates.push_back(i);
 
-    for (unsigned i = 0; i < detections.size(); i++)
+    Arena _buffer;
+    float *_crops = _buffer.allocate<float>(candidates.size() * crop);
+    vector<Mat> batch(candidates.size());
+    for (size_t n = 0; n < candidates.size(); n++)
     {
-        Mat img, imageROI;
-        imageROI = image(detections[i].face & imgRoi);
-
-        resize(imageROI, img, Size(params.KernelW, params.KernelH), 0, 0, INTER_AREA);
+        const Rect roi = detections[candidates[n]].face & imgRoi;
+        Resample::resize(image.ptr<float>(roi.y) + roi.x, image.step1(), roi.height, roi.width,
+                         _crops + n * crop, size.width, size.width, size.height, _buffer);
+        batch[n] = Mat(size, CV_32F, _crops + n * crop);
+    }
 
-        net.forward(img, score);
+    Workspace _workspace;
+    vector<vector<Mat> > scores;
+    net.forward(batch, scores, _workspace);
 
-        if (score[0].at<float>(0,0) > thr)
+    vector<Detection> survivors;
+    for (size_t n = 0; n < candidates.size(); n++)
+    {
+        const float score = scores[n][0].at<float>(0,0);
+        if (score > thr)
         {
             Detection detect;
-            detect.face = detections[i].face;
-            detect.score = score[0].at<float>(0,0);
-
-            if (useCalibration)
-            {
-                vector<Mat> calibOutput;
-                Mat transformation;
-                calibNet.forward(img, calibOutput);
-                calibResults(calibOutput, transformation);
-                applyTransformationCode(detect, transformation, calibThr);
-            }
+            detect.face  = detections[candidates[n]].face;
+            detect.score = score;
+            if (survivors.size() != n)
+                std::copy(_crops + n * crop, _crops + (n + 1) * crop, _crops + survivors.size() * crop);
+            survivors.push_back(detect);
+        }
+    }
+    batch.resize(survivors.size());
 
-            outputs.push_back(detect);
+    if (useCalibration && !survivors.empty())
+    {
+        vector<vector<Mat> > calibOutputs;
+        calibNet.forward(batch, calibOutputs, _workspace);
+        for (size_t n = 0; n < survivors.size(); n++)
+        {
+            Mat transformation;
+            calibResults(calibOutputs[n], transformation);
+            applyTransformationCode(survivors[n], transformation, calibThr);
         }
     }
+    outputs.insert(outputs.end(), survivors.begin(), survivors.end());
 }
 
+template void cnn::Alg::forwardDetection(const Mat&, const vector<Detection>&,
+                                         const cnn::CNN&, const cnn::CNN&,
+                                         const cnn::CNNParam&, vector<Detection>&,
+                                         float, float, bool);
+template void cnn::Alg::forwardDetection(const Mat&, const vector<Detection>&,
+                                         const cnn::FixedCNN48&, const cnn::FixedCNN48Calibration&,
+                                         const cnn::CNNParam&, vector<Detection>&,
+                                         float, float, bool);
+
 void cnn::Alg::calibrate(const Mat &img,
                       const cnn::CNN &net,
                       vector<Detection> &detections,
                       float calibThr)
 {
+    // Only the first output pixel is read, so crops are cut to the pixels
+    // it sees. Crops of one size run as one batch; the windows of detect
+    // lie inside img, so that is usually all of them.
+    const Size field = net.field();
     Rect imgRoi(0,0,img.cols, img.rows);
-    for (size_t i = 0; i < detections.size(); i ++)
+    vector<Rect> crops(detections.size());
+    vector<size_t> order(detections.size());
+    for (size_t i = 0; i < detections.size(); i++)
+    {
+        crops[i] = detections[i].face & imgRoi;
+        crops[i].width  = std::min(crops[i].width, field.width);
+        crops[i].height = std::min(crops[i].height, field.height);
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&crops](size_t a, size_t b)
+    {
+        return crops[a].width < crops[b].width ||
+               (crops[a].width == crops[b].width && crops[a].height < crops[b].height);
+    });
+
+    Workspace _workspace;
+    vector<Mat> batch;
+    vector<Tensor> outputs;
+    for (size_t begin = 0, end = 0; begin < order.size(); begin = end)
+    {
+        const Size size = crops[order[begin]].size();
+        batch.clear();
+        for (end = begin; end < order.size() && crops[order[end]].size() == size; end++)
+            batch.push_back(img(crops[order[end]]));
+
+        net.forward(batch, outputs, *net.cachedPlan(size, img.channels(), _workspace.threads),
+                    _workspace.arena, _workspace.threads);
+        for (size_t k = begin; k < end; k++)
+        {
+            const Tensor &output = outputs[k - begin];
+            CV_Assert(output.channels() == CalibrationCodes::COUNT);
+            applyCalibration(detections[order[k]], calibrationHits(output.ptr(), output.blockStep(), calibThr));
+        }
+    }
+}
+
+// Scales of the levels of the pyramid of image, from the smallest faces,
+// which are the largest levels.
+static void pyramidFactors(const Mat &image, const cnn::PyramidParam &pyramid, vector<double> &factors)
+{
+    for (double faceSize = pyramid.minFaceSize;
+         faceSize < min(image.rows, image.cols) && faceSize < pyramid.maxFaceSize;
+         faceSize *= pyramid.pyramidRate)
+        factors.push_back(pyramid.winSize / faceSize);
+}
+
+void cnn::Alg::buildPyramid(const Mat &image,
+                            const cnn::PyramidParam &pyramid,
+                            vector<double> &factors,
+                            vector<Mat> &levels)
+{
+    CV_Assert(image.type() == CV_8UC1);
+    factors.clear();
+    pyramidFactors(image, pyramid, factors);
+
+    // Mean and deviation in 8-bit units: (p - mean) / stdev is p / 255
+    // normalized.
+    uint64_t sum, squares;
+    Resample::moments(image.ptr<uint8_t>(), image.step1(), image.rows, image.cols, sum, squares);
+    const double n     = static_cast<double>(image.total());
+    const double mean  = sum / n;
+    const double stdev = std::sqrt(std::max(squares / n - mean * mean, 0.));
+    const float  norm  = static_cast<float>(1. / ((stdev == 0.) ? 255. : stdev));
+
+    Arena _scratch;
+    levels.resize(factors.size());
+    for (size_t level = 0; level < factors.size(); level++)
+    {
+        Mat &output = levels[level];
+        output.create(Size(cvRound(image.cols * factors[level]), cvRound(image.rows * factors[level])), CV_32F);
+
+        // The cells of a level whole times smaller than an earlier one are
+        // whole boxes of it, but for the last row and column, which can
+        // reach past the pixels of the earlier level and are redone.
+        int from = -1;
+        double ratio = 0.;
+        for (int j = static_cast<int>(level) - 1; j >= 0 && from < 0; j--)
+        {
+            ratio = std::floor(factors[j] / factors[level] + .5);
+            if (ratio >= 2. && std::abs(factors[j] / factors[level] - ratio) < 1e-6)
+                from = j;
+        }
+        if (from >= 0)
+        {
+            const Mat &input = levels[from];
+            Resample::area(input.ptr<float>(), input.step1(), input.rows, input.cols, ratio, 0.f, 1.f,
+                           output.ptr<float>(), output.step1(), output.cols, output.rows, _scratch);
+
+            Resample::Taps _columns, _rows;
+            Resample::taps(image.cols, output.cols, 1. / factors[level], _columns);
+            Resample::taps(image.rows, output.rows, 1. / factors[level], _rows);
+            const auto redo = [&](int x, int y)
+            {
+                const float value = Resample::pixel(image.ptr<uint8_t>(), image.step1(), _columns, _rows, x, y);
+                output.at<float>(y, x) = (value - static_cast<float>(mean)) * norm;
+            };
+            for (int y = 0; y < output.rows; y++)
+                redo(output.cols - 1, y);
+            for (int x = 0; x < output.cols - 1; x++)
+                redo(x, output.rows - 1);
+        }
+        else
+            Resample::area(image.ptr<uint8_t>(), image.step1(), image.rows, image.cols, 1. / factors[level],
+                           static_cast<float>(mean), norm,
+                           output.ptr<float>(), output.step1(), output.cols, output.rows, _scratch);
+    }
+}
+
+void cnn::Alg::detectPyramid(const Mat &image,
+                             const cnn::CNN &net,
+                             const cnn::CNN &calibNet,
+                             const cnn::CNNParam &params,
+                             const cnn::PyramidParam &pyramid,
+                             vector<Detection> &detections,
+                             int threads)
+{
+    vector<double> factors;
+    vector<Mat> built;
+    if (image.depth() == CV_8U)
+        buildPyramid(image, pyramid, factors, built);
+    else
+        pyramidFactors(image, pyramid, factors);
+
+    vector<vector<Detection> > levels(factors.size());
+    Arena _scratch;
+    Parallel::steal(static_cast<int>(factors.size()), threads, [&](int level, Arena&)
+    {
+        Mat resized, score;
+        if (built.empty())
+            resize(image, resized, Size(0,0), factors[level], factors[level], INTER_AREA);
+        else
+            resized = built[level];
+
+        vector<Detection> &outputs = levels[level];
+        detect(resized, net, params, outputs, score, pyramid.thr, pyramid.scale);
+        calibrate(resized, calibNet, outputs, pyramid.calibThr);
+        nms(outputs, pyramid.nmsThr);
+        backProject(outputs, factors[level]);
+    }, _scratch);
+
+    for (size_t level = 0; level < levels.size(); level++)
+        detections.insert(detections.end(), levels[level].begin(), levels[level].end());
+}
+
+void cnn::Alg::detectCanvas(const Mat &image,
+                            const cnn::CNN &net,
+                            const cnn::CNN &calibNet,
+                            const cnn::CNNParam &params,
+                            const cnn::PyramidParam &pyramid,
+                            vector<Detection> &detections,
+                            int threads)
+{
+    vector<double> factors;
+    vector<Mat> resized;
+    if (image.depth() == CV_8U)
+        buildPyramid(image, pyramid, factors, resized);
+    else
+    {
+        pyramidFactors(image, pyramid, factors);
+        resized.resize(factors.size());
+        for (size_t level = 0; level < factors.size(); level++)
+            resize(image, resized[level], Size(0,0), factors[level], factors[level], INTER_AREA);
+    }
+    if (factors.empty())
+        return;
+
+    // Shelves as wide as the two largest levels side by side, filled left
+    // to right from the largest level on.
+    const int stride = net.stride();
+    const auto align = [stride](int value) { return (value + stride - 1) / stride * stride; };
+    const int guard  = align(std::max(params.KernelW, params.KernelH));
+    const int width  = align(resized[0].cols + guard + (resized.size() > 1 ? resized[1].cols : 0));
+    vector<Rect> regions(resized.size());
+    Size canvasSize(0, 0);
+    for (size_t level = 0, x = 0, y = 0, shelf = 0; level < resized.size(); level++)
+    {
+        if (x > 0 && x + resized[level].cols > static_cast<size_t>(width))
+        {
+            y     = align(static_cast<int>(y + shelf) + guard);
+            x     = 0;
+            shelf = 0;
+        }
+        regions[level]    = Rect(static_cast<int>(x), static_cast<int>(y), resized[level].cols, resized[level].rows);
+        x                 = align(static_cast<int>(x) + resized[level].cols + guard);
+        shelf             = std::max<size_t>(shelf, resized[level].rows);
+        canvasSize.width  = std::max(canvasSize.width, regions[level].x + regions[level].width);
+        canvasSize.height = std::max(canvasSize.height, regions[level].y + regions[level].height);
+    }
+    Mat canvas = Mat::zeros(canvasSize, CV_32F);
+    for (size_t level = 0; level < resized.size(); level++)
+        resized[level].copyTo(canvas(regions[level]));
+
+    Workspace _workspace(threads);
+    vector<Mat> scores;
+    vector<Rect> outputs;
+    net.forward(canvas, regions, scores, outputs, _workspace);
+
+    // The hits of detect on each level, then its second half.
+    vector<vector<Detection> > levels(factors.size());
+    for (size_t level = 0; level < levels.size(); level++)
     {
-        vector<Mat> calibOutput;
-        Mat transformation;
-        net.forward(img(detections[i].face & imgRoi), calibOutput);
-        calibResults(calibOutput, transformation);
-        applyTransformationCode(detections[i], transformation, calibThr);
+        const Mat score = scores[0](outputs[level]);
+        for (int r = 0; r < score.rows; r++)
+            for (int c = 0; c < score.cols; c++)
+            {
+                const float response = score.at<float>(r, c);
+                if (response > pyramid.thr)
+                {
+                    Detection det;
+                    det.face  = Rect(c * pyramid.scale, r * pyramid.scale, params.KernelW, params.KernelH);
+                    det.score = response;
+                    levels[level].push_back(det);
+                }
+            }
     }
+
+    Arena _scratch;
+    Parallel::steal(static_cast<int>(factors.size()), threads, [&](int level, Arena&)
+    {
+        vector<Detection> &outputs = levels[level];
+        calibrate(resized[level], calibNet, outputs, pyramid.calibThr);
+        nms(outputs, pyramid.nmsThr);
+        backProject(outputs, factors[level]);
+    }, _scratch);
+
+    for (size_t level = 0; level < levels.size(); level++)
+        detections.insert(detections.end(), levels[level].begin(), levels[level].end());
 }
 
 void cnn::Alg::nms(vector<Detection> &detections,
@@ -38,8 +38,17 @@
 
 #include <fstream>
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include "opencv2/opencv.hpp"
 #include "bpersistence.hpp"
+#include "tensor.h"
+#include "gemm.h"
+#include "winograd.h"
+#include "direct.h"
+#include "quant.h"
+#include "tune.h"
 
 using namespace cv;
 using namespace std;
@@ -77,6 +86,21 @@ namespace cnn
         int NLayers;
     };
 
+    // Levels and thresholds of the first stage scan (Alg::detectPyramid):
+    // faces from minFaceSize up to maxFaceSize pixels, a level every
+    // pyramidRate, each resized so that a face spans winSize pixels.
+    struct PyramidParam
+    {
+        double winSize;
+        double minFaceSize;
+        double maxFaceSize;
+        double pyramidRate;
+        float  thr;                 // on the 20net score
+        float  scale;               // level pixels per score pixel
+        float  calibThr;
+        float  nmsThr;
+    };
+
 
     struct CNNStringParam
     {
@@ -88,8 +112,57 @@ namespace cnn
         const static string KernelH;
         const static string KernelD;
         const static string NLayers;
+        const static string Algorithm;
+        const static string Head;
+        const static string QuantScale;
+        const static string QuantZero;
+        const static string WeightFormat;
+    };
+
+    // Convolution engine used by CONV and FC layers. The choice is stored
+    // per layer under CNNStringParam::Algorithm; AUTO lets the runtime pick.
+    struct CNNConvAlgo
+    {
+        enum
+        {
+            AUTO        = 0,
+            DIRECT      = 1,
+            GEMM        = 2,
+            WINOGRAD2X2 = 3,
+            WINOGRAD4X4 = 4,
+            SPECIALIZED = 5,
+            GEMV        = 6,    // FC layers producing a single pixel
+            INT8        = 7     // layers calibrated by CNN::quantize
+        };
+    };
+
+    // Output of a two-class SOFTMAX layer, stored per layer under
+    // CNNStringParam::Head. SIGMOID and LOGIT emit a single plane for class 0:
+    // its probability sigmoid(l0 - l1), which equals the softmax, or the logit
+    // l0 - l1 itself, to be thresholded against Alg::logit(threshold) without
+    // any exp. Other layers ignore the setting.
+    struct CNNHead
+    {
+        enum
+        {
+            SOFTMAX = 0,
+            SIGMOID = 1,
+            LOGIT   = 2
+        };
     };
 
+    // Storage of CONV and FC weights, in memory and on disk, stored per layer
+    // under CNNStringParam::WeightFormat (same values as Half). FP16 and BF16
+    // halve the weights and are widened inside the direct and GEMV kernels.
+    struct CNNWeightFormat
+    {
+        enum
+        {
+            FP32 = Half::FP32,
+            FP16 = Half::FP16,
+            BF16 = Half::BF16
+        };
+    };
 
     struct CNNOpType
     {
@@ -111,6 +184,25 @@ namespace cnn
         vector<Mat>       weights;
         vector<float>     bias;
 
+        // Weights as one nLayers x (kernelD * kH * kW) row-major matrix, packed
+        // for the GEMM engine and blocked for the direct kernels, all derived
+        // from weights by prepare(). Afterwards weights are views of matrix.
+        // With a 16-bit weightFormat() matrix, blocked and weights hold CV_16U
+        // Half codes, and packed is only built if no direct kernel fits.
+        Mat               matrix;
+        Mat               packed;
+        Mat               blocked;
+        // Winograd F(2x2,3x3) / F(4x4,3x3) weight transforms, blocked per
+        // element (3x3, stride 1 CONV only).
+        Mat               winograd2x2;
+        Mat               winograd4x4;
+        // Int8 weights, their per-channel steps and code sums (see Quant),
+        // built once the layer carries activation parameters
+        // (CNNStringParam::QuantScale / QuantZero).
+        Mat               quantized;
+        vector<float>     quantScales;
+        vector<int32_t>   quantSums;
+
         void write(FileStorage &fs) const;
         void write(ostream &f) const;
 
@@ -120,9 +212,148 @@ namespace cnn
         void setParam(const string &param, float value);
         void setParams(const map<string, float> &p);
         void setParams(const CNNParam &p);
+        int  algorithm() const;
+        int  head() const;
+        int  weightFormat() const;
+        // Converts the weights to format and prepares the layer again.
+        void setWeightFormat(int format);
+        void prepare();
+        void transformWinograd(int tile, int nLayers, int kernelD, Mat &transformed) const;
         friend ostream& operator<<(ostream &out, const CNNLayer& w);
     };
 
+    // One layer of a compiled CNN: the op, its parameters as integers and
+    // the kernels and engines resolved for it, so that CNN::forward walks a
+    // flat array without any string or map lookups. Only the choice between
+    // engines that depends on the input size is left to CNN::plan.
+    struct CNNStep
+    {
+        enum
+        {
+            CONV    = 0,
+            FC      = 1,
+            RELU    = 2,
+            SOFTMAX = 3,
+            MAXPOOL = 4
+        };
+
+        int    op;
+        size_t layer;               // index of the CNNLayer
+        // Layer built by a graph pass that replaces it, if any.
+        shared_ptr<const CNNLayer> derived;
+        int    nLayers;
+        int    kernelD;
+        int    kernelW;
+        int    kernelH;
+        int    strideW;
+        int    strideH;
+        int    padW;
+        int    padH;
+        int    algorithm;           // CNNConvAlgo requested by the layer
+        int    weightFormat;
+        int    head;
+        Quant::Activation activation;
+
+        // Engines the layer has weights for.
+        Direct::Kernel       direct;
+        Direct::PooledKernel pooled;
+        bool   reference;
+        bool   gemm;
+        bool   winograd;
+        bool   int8;
+
+        // Layers a CONV/FC can absorb: the RELU right after it, or, with a
+        // pooled kernel, the MAXPOOL (window) and a RELU among the next
+        // pooledSpan steps.
+        bool   reluNext;
+        int    pooledSpan;
+        bool   pooledRelu;
+        MaxPool::Window window;     // also the window of a MAXPOOL step
+    };
+
+    // One op of a forward pass over a given input size: a step, the engine
+    // resolved for it and the steps up to last it absorbs.
+    struct CNNCall
+    {
+        size_t step;
+        size_t last;
+        int    algorithm;
+        bool   relu;
+        bool   pool;
+        int    channels;            // output shape
+        int    rows;
+        int    cols;
+        size_t scratch;             // bytes of arena scratch it takes
+        double flops;               // cost, for splitting it across threads
+    };
+
+    // Memory plan of a forward pass over one input size. Intermediates live
+    // from the call that writes them to the next one, so they alternate
+    // between two slots at the start of the arena: the input and the outputs
+    // of odd calls in slot 0, the outputs of even calls in slot 1. Scratch
+    // follows the slots and is released after every call.
+    struct CNNShapePlan
+    {
+        Size   input;
+        int    channels;
+        int    threads;             // the engines were chosen for (see Tuning)
+        bool   regions;             // for a pass over regions: padded pools stay unfused
+        vector<CNNCall> calls;
+        size_t slots[2];
+        size_t scratch;
+
+        size_t arenaSize() const { return slots[0] + slots[1] + scratch; }
+    };
+
+    // Shape plans of one CNN keyed by input size and channels, so a stream
+    // of frames plans each pyramid level once. Lookups are serialized;
+    // plans are shared, so one stays valid for whoever holds it after the
+    // cache drops it. A copy starts empty.
+    struct CNNPlanCache
+    {
+        enum { CAPACITY = 256 };    // cleared when full
+
+        // channels, threads, rows, cols, regions
+        typedef tuple<int, int, int, int, bool> Key;
+
+        map<Key, shared_ptr<const CNNShapePlan> > plans;
+        size_t hits;
+        size_t misses;
+        mutex  lock;
+
+        CNNPlanCache(): hits(0), misses(0) {}
+        CNNPlanCache(const CNNPlanCache&): CNNPlanCache() {}
+        CNNPlanCache& operator=(const CNNPlanCache&)
+        {
+            plans.clear();
+            hits = misses = 0;
+            return *this;
+        }
+    };
+
+    // Scratch memory of forward passes for one thread: every intermediate
+    // of a pass lives in the arena, which grows to the largest pass it has
+    // served and is then reused without touching the heap. A Workspace is
+    // used by one pass at a time; the CNN it is passed to can be shared.
+    //
+    // threads is how many threads a pass may spread each layer over (see
+    // Parallel); layers too small to gain from it run on the caller alone.
+    class Workspace
+    {
+    public:
+        Workspace(int threads = 1): threads(threads) {}
+
+        Arena arena;
+        int   threads;
+    };
+
+    // Concurrency: after it is built a CNN is only read by its const
+    // methods, so any number of threads may run forward on one CNN at once,
+    // each with its own Workspace (without one a pass allocates its own
+    // scratch). The plan cache serializes its own lookups and the debug dump
+    // is written one pass at a time. Methods that change the layers or
+    // plans (addLayer, compile, setHead, setTuning, quantize, ...) must not
+    // run concurrently with any other use of the same CNN.
     struct CNN
     {
     private:
@@ -130,14 +361,43 @@ namespace cnn
         map<string,size_t> _map;
         vector<CNNLayer>   _layers;
         vector<string>     _network;
+        vector<CNNStep>    _steps;
+        mutable CNNPlanCache _cache;
+        shared_ptr<const Tuning> _tuning;
         bool _debug;
 
         string generateLayerName(const string &type);
 
+        // plan, with the engines of AUTO layers looked up in tuning.
+        void plan(const Size &size, int channels, int threads, bool regions,
+                  const Tuning *tuning, CNNShapePlan &plan) const;
+        Tuning::Key tuningKey(const CNNStep &step, int channels, int rows, int cols,
+                              int threads) const;
+
+        // forward, optionally widening ranges[layer] to the range of the
+        // input of every CONV and FC layer, or over regions of the input,
+        // which are mapped to the output in place.
+        void forward(const Mat &input, Tensor &output, const CNNShapePlan &plan,
+                     Arena &arena, int threads, vector<Vec2f> *ranges,
+                     vector<Rect> *regions = nullptr) const;
+
+        // One call of a plan on one input, split into parts.
+        void run(const CNNCall &call, const Tensor &input, Tensor &output,
+                 Arena &arena, int parts) const;
+        void dump(const CNNStep &step, const Tensor &output) const;
+
     public:
         CNN(const string &name = "", bool debug = false): _name(name), _debug(debug){};
+        // Changes to a layer obtained here take effect after compile().
         CNNLayer& getLayer(const string &name);
         CNNLayer& addLayer(const CNNLayer &layer);
+        // Number of layers, and the layer at a position of the network.
+        size_t size() const { return _network.size(); }
+        const CNNLayer& getLayer(size_t index) const;
+
+        // Rebuilds the execution plan from the layers, rewritten by the
+        // Graph passes. Every CNN method that changes the layers calls it.
+        void compile();
 
         void write(FileStorage &fs) const;
         void write(ostream &f) const;
@@ -145,6 +405,94 @@ namespace cnn
         void read(const FileNode &node);
 
         void forward(const Mat &input, vector<Mat> &output) const;
+        void forward(const Mat &input, vector<Mat> &output, Workspace &workspace) const;
+
+        // forward over regions of input: disjoint rectangles, each standing
+        // for an input of its own, that start at multiples of stride() and
+        // lie at least a window of the net apart. Every padded layer sees
+        // its padding around each region instead of the pixels next to it,
+        // so the output inside outputRegions[i] is that of a pass over
+        // regions[i] alone, and many small inputs take one pass.
+        void forward(const Mat &input, const vector<Rect> &regions, vector<Mat> &output,
+                     vector<Rect> &outputRegions, Workspace &workspace) const;
+        // Input pixels between two neighbouring outputs.
+        int stride() const;
+        // Input the first output pixel depends on: any larger input gives
+        // that pixel the same value.
+        Size field() const;
+
+        // Batched forward over inputs of one size and type, with the outputs
+        // of inputs[n] in outputs[n]. The pass runs layer by layer over the
+        // whole batch, so a layer's weights are loaded once for all of it,
+        // and FC layers that reduce the input to one pixel run as one GEMM
+        // (Op::FC_GEMM) instead of a GEMV per input once the batch reaches
+        // Op::FC_GEMM_BATCH. Small layers are split across threads by input
+        // rather than within one.
+        void forward(const vector<Mat> &inputs, vector<vector<Mat> > &outputs) const;
+        void forward(const vector<Mat> &inputs, vector<vector<Mat> > &outputs,
+                     Workspace &workspace) const;
+
+        // Plans the intermediates and engines of a forward pass over inputs
+        // of the given size and number of channels, run on threads threads,
+        // over the whole input or over regions of it.
+        void plan(const Size &size, int channels, CNNShapePlan &plan, int threads = 1,
+                  bool regions = false) const;
+        size_t arenaSize(const Size &size, int channels = 1, int threads = 1) const;
+
+        // The plan for the shape, from the cache or made and cached on a miss.
+        // forward(input, output) goes through it. compile() and setTuning()
+        // empty the cache.
+        shared_ptr<const CNNShapePlan> cachedPlan(const Size &size, int channels = 1,
+                                                  int threads = 1, bool regions = false) const;
+        size_t planCacheHits() const;
+        size_t planCacheMisses() const;
+
+        // Prints the FLOPs of every layer of a pass over an input of the given
+        // size, as loaded and after the graph passes of compile().
+        void printFlops(const Size &size, int channels, ostream &out) const;
+
+        // forward over an input of the size the plan was made for, with all
+        // intermediates and scratch in arena, which is grown to the plan
+        // first. Once the arena is large enough a pass makes no heap
+        // allocation. The Tensor output is a view of the arena, valid until
+        // it is used again. Layers are split over up to threads threads.
+        void forward(const Mat &input, vector<Mat> &output,
+                     const CNNShapePlan &plan, Arena &arena, int threads = 1) const;
+        void forward(const Mat &input, Tensor &output,
+                     const CNNShapePlan &plan, Arena &arena, int threads = 1) const;
+        // Batched forward on a plan for the size of the inputs, with
+        // everything but the output Tensors' headers in arena.
+        void forward(const vector<Mat> &inputs, vector<Tensor> &outputs,
+                     const CNNShapePlan &plan, Arena &arena, int threads = 1) const;
+        // Bytes of arena a batched pass of batch inputs on plan takes.
+        size_t arenaSize(const CNNShapePlan &plan, int batch) const;
+
+        // Engines for the layers left on CNNConvAlgo::AUTO, used by plan()
+        // where they have an entry for the shape, thread count and ISA level;
+        // the heuristics of AUTO decide elsewhere.
+        void setTuning(const shared_ptr<const Tuning> &tuning);
+
+        // Autotuning: benchmarks every engine each AUTO CONV and FC layer
+        // supports on passes over a random input of the given shape with
+        // threads threads, one layer at a time with the others on their best
+        // choice so far, and records the fastest of each in tuning. The
+        // reference engine and INT8, which changes the results, are not
+        // candidates. Takes a few passes per engine and layer.
+        void tune(const Size &size, int channels, int threads, Tuning &tuning,
+                  int repeats = 5) const;
+
+        // Calibrates the int8 activation parameters of every CONV and FC
+        // layer on the input ranges seen over images, then switches those
+        // layers to CNNConvAlgo::INT8.
+        void quantize(const vector<Mat> &images);
+
+        // Sets the CNNHead of the last layer, if it is a SOFTMAX.
+        void setHead(int head);
+
+        // Sets the CNNWeightFormat of every FC layer, which hold nearly all
+        // the weights. CONV layers keep theirs (float unless their wfmt param
+        // says otherwise) so they can still run Winograd.
+        void setWeightFormat(int format);
 
         friend ostream& operator<<(ostream &out, const CNN& w);
     };
@@ -152,6 +500,15 @@ namespace cnn
     class Op
     {
     public:
+        enum
+        {
+            WINOGRAD_CHUNK = 24,    // tiles transformed at a time by CONV_WINOGRAD
+            INT8_CHUNK     = 128,   // output pixels per int8 GEMM of CONV_INT8
+            // Batch from which FC_GEMM beats a GEMV per input: its
+            // micro-kernel computes Gemm::NR columns whatever the batch.
+            FC_GEMM_BATCH  = 8
+        };
+
         static void CONV(const vector<Mat> &input,
                          const vector<Mat> &weights,
                          vector<Mat> &output,
@@ -185,6 +542,173 @@ namespace cnn
 
         static void softmax(const Mat &input,Mat &output);
 
+        // Channel-blocked versions used by CNN::forward. CONV and FC convert
+        // to planes and run the reference implementations above. The others
+        // take their temporaries from scratch and release them before they
+        // return, or allocate them when there is no arena, and split their
+        // output into up to parts parts run in parallel (see Parallel).
+        static void CONV(const Tensor &input,
+                         const vector<Mat> &weights,
+                         Tensor &output,
+                         const vector<float> &bias,
+                         const int nLayers,
+                         const int kernelD,
+                         const int strideW,
+                         const int strideH,
+                         const int paddW,
+                         const int paddH);
+
+        static void FC(const Tensor &input,
+                       const vector<Mat> &weights,
+                       const vector<float> &bias,
+                       Tensor &output,
+                       size_t outputs);
+
+        static void MAX_POOL(const Tensor &input,
+                             Tensor &output,
+                             int width,
+                             int height,
+                             int strideW,
+                             int strideH,
+                             int paddingW,
+                             int paddingH,
+                             Arena *scratch = nullptr,
+                             int parts = 1);
+
+        static void RELU(const Tensor &input,
+                         Tensor &output);
+
+        static void SOFTMAX(const Tensor &input,
+                            Tensor &output,
+                            const int head = CNNHead::SOFTMAX);
+
+        static void CONV_GEMM(const Tensor &input,
+                              const Mat &packedWeights,
+                              Tensor &output,
+                              const vector<float> &bias,
+                              const int nLayers,
+                              const int kernelD,
+                              const int kernelW,
+                              const int kernelH,
+                              const int strideW,
+                              const int strideH,
+                              const int paddW,
+                              const int paddH,
+                              Arena *scratch = nullptr,
+                              int parts = 1);
+
+        static void CONV_DIRECT(const Tensor &input,
+                                const Mat &blockedWeights,
+                                Tensor &output,
+                                const vector<float> &bias,
+                                const int nLayers,
+                                const int kernelD,
+                                const int kernelW,
+                                const int kernelH,
+                                const int strideW,
+                                const int strideH,
+                                const int paddW,
+                                const int paddH,
+                                const bool relu = false,
+                                const int weightFormat = CNNWeightFormat::FP32,
+                                Arena *scratch = nullptr,
+                                int parts = 1);
+
+        // Fully connected layer over the whole input: flattens it once and
+        // runs a GEMV on the row-major weight matrix.
+        static void FC_GEMV(const Tensor &input,
+                            const Mat &weightMatrix,
+                            const vector<float> &bias,
+                            Tensor &output,
+                            const int nLayers,
+                            const bool relu = false,
+                            const int weightFormat = CNNWeightFormat::FP32,
+                            Arena *scratch = nullptr,
+                            int parts = 1);
+
+        // FC_GEMV over a batch of same-shaped inputs as one GEMM on the
+        // packed weights (CNNLayer::packed), so every weight is read once
+        // per batch instead of once per input. The outputs must already be
+        // created (nLayers x 1 x 1). Parts split the output channels.
+        static void FC_GEMM(const vector<Tensor> &inputs,
+                            const Mat &packedWeights,
+                            const vector<float> &bias,
+                            vector<Tensor> &outputs,
+                            const int nLayers,
+                            const bool relu = false,
+                            Arena *scratch = nullptr,
+                            int parts = 1);
+        static size_t fcGemmScratch(int nLayers, int K, int batch);
+
+        // CONV_DIRECT, bias, MAX_POOL and optionally RELU in one pass.
+        static void CONV_POOL(const Tensor &input,
+                              const Mat &blockedWeights,
+                              Tensor &output,
+                              const vector<float> &bias,
+                              const int nLayers,
+                              const int kernelD,
+                              const int kernelW,
+                              const int kernelH,
+                              const int strideW,
+                              const int strideH,
+                              const int paddW,
+                              const int paddH,
+                              const int poolW,
+                              const int poolH,
+                              const int poolStrideW,
+                              const int poolStrideH,
+                              const int poolPaddW,
+                              const int poolPaddH,
+                              const bool relu,
+                              const int weightFormat = CNNWeightFormat::FP32,
+                              Arena *scratch = nullptr,
+                              int parts = 1);
+
+        static void CONV_WINOGRAD(const Tensor &input,
+                                  const Mat &transformedWeights,
+                                  Tensor &output,
+                                  const vector<float> &bias,
+                                  const int nLayers,
+                                  const int kernelD,
+                                  const int paddW,
+                                  const int paddH,
+                                  const int tile,
+                                  const bool relu = false,
+                                  Arena *scratch = nullptr,
+                                  int parts = 1);
+
+        // CONV (or FC) on int8 codes of the input, dequantized to float.
+        static void CONV_INT8(const Tensor &input,
+                              const Mat &quantizedWeights,
+                              const vector<float> &weightScales,
+                              const vector<int32_t> &weightSums,
+                              Tensor &output,
+                              const vector<float> &bias,
+                              const int nLayers,
+                              const int kernelD,
+                              const int kernelW,
+                              const int kernelH,
+                              const int strideW,
+                              const int strideH,
+                              const int paddW,
+                              const int paddH,
+                              const Quant::Activation &activation,
+                              const bool relu = false,
+                              Arena *scratch = nullptr,
+                              int parts = 1);
+
+        static void im2col(const Tensor &input,
+                           float *packed,
+                           int kernelW,
+                           int kernelH,
+                           int strideW,
+                           int strideH,
+                           int paddW,
+                           int paddH,
+                           int outputW,
+                           int k0, int kc,
+                           int n0, int nc);
+
         static void conv(const Mat &input,
                          const Mat &weight,
                          Mat &output,
@@ -222,6 +746,24 @@ namespace cnn
         static void heatMapFromScore(const Mat &score, Mat &heatmap, Size size = Size(0,0));
 
         static void forward(const Mat &img, const cnn::CNN &net, Mat &score, int layer = 0);
+
+        // Threshold on the output of a CNNHead::LOGIT layer equivalent to
+        // the probability threshold p.
+        static float logit(float p) { return std::log(p / (1.f - p)); }
+
+        // Images of a directory as network inputs (grayscale, normalized
+        // like the detector's input), resized to size unless it is empty.
+        static void loadSamples(const string &directory, Size size, vector<Mat> &samples);
+
+        // Prints how far the outputs of quantized drift from those of
+        // reference over samples: the largest and mean absolute difference,
+        // and how many plane-0 scores land on the other side of thr.
+        static void quantizationDrift(const string &stage,
+                                      const cnn::CNN &reference,
+                                      const cnn::CNN &quantized,
+                                      const vector<Mat> &samples,
+                                      float thr,
+                                      ostream &out);
         
         static void detect(const Mat &img,
                            const cnn::CNN &net,
@@ -234,10 +776,16 @@ namespace cnn
         static void calibResults(const vector<Mat> &scores, Mat &results);
 
 
+        // Second stage: the crops of detections resized to the kernel of
+        // params (Resample::resize) into one buffer, net over all of them as
+        // a batch, then calibNet over the batch of those scoring over thr.
+        // Net and CalibNet are CNN, whose batches run their FC layers as
+        // GEMMs, or the FixedCNN48 / FixedCNN48Calibration pair (fixed.h).
+        template<class Net, class CalibNet>
         static void forwardDetection(const Mat &image,
                                      const vector<Detection> &detections,
-                                     const cnn::CNN &net,
-                                     const cnn::CNN &calibNet,
+                                     const Net &net,
+                                     const CalibNet &calibNet,
                                      const cnn::CNNParam &params,
                                      vector<Detection> &outputs,
                                      float thr, float calibThr, bool useCalibration = true);
@@ -247,6 +795,43 @@ namespace cnn
                               vector<Detection> &detections,
                               float calibThr);
 
+        // The levels of the pyramid of an 8-bit grayscale image, from the
+        // largest, with their factors: image normalized as by Op::normGlobal
+        // and area resized, in one pass over image per level (Resample). The
+        // mean and deviation come from one pass in integers, and a level a
+        // whole number of times smaller than an earlier one is made from it.
+        static void buildPyramid(const Mat &image,
+                                 const cnn::PyramidParam &pyramid,
+                                 vector<double> &factors,
+                                 vector<Mat> &levels);
+
+        // First stage over every level of the pyramid of image: resize,
+        // detect with net, calibrate with calibNet, nms and backProject.
+        // Levels are independent tasks run largest first on up to threads
+        // threads (Parallel::steal), each into a list of its own; the lists
+        // are then appended in level order, as a loop over the levels would.
+        // An 8-bit image is normalized and resized by buildPyramid, a float
+        // one is taken as normalized.
+        static void detectPyramid(const Mat &image,
+                                  const cnn::CNN &net,
+                                  const cnn::CNN &calibNet,
+                                  const cnn::CNNParam &params,
+                                  const cnn::PyramidParam &pyramid,
+                                  vector<Detection> &detections,
+                                  int threads);
+
+        // detectPyramid with one pass of net for all the levels: they are
+        // packed on a canvas, on the stride of net and a window apart, and
+        // scanned as regions of it (CNN::forward), so small levels cost no
+        // call of their own. Gives the boxes of detectPyramid.
+        static void detectCanvas(const Mat &image,
+                                 const cnn::CNN &net,
+                                 const cnn::CNN &calibNet,
+                                 const cnn::CNNParam &params,
+                                 const cnn::PyramidParam &pyramid,
+                                 vector<Detection> &detections,
+                                 int threads);
+
         static void nms(vector<Detection> &detections,
                         const float &threshold);
         static void backProject(vector<Detection> &detects,
@@ -0,0 +1,376 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <algorithm>
+#include "direct.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+using namespace cnn::simd;
+
+namespace
+{
+    const int BLOCK = Tensor::BLOCK;
+
+    struct Args
+    {
+        const float *input;
+        size_t       inputBlock;
+        size_t       inputRow;
+        int          inputLanes;
+        const void  *weights;       // W::type
+        size_t       weightBlock;
+        const float *bias;
+        float       *output;
+        size_t       outputBlock;
+        size_t       outputRow;
+        int          outputLanes;
+        int          nLayers;
+        int          kernelD;
+        bool         relu;
+    };
+
+    // Pooled columns per strip of the pooled kernels.
+    const int STRIP = 32;
+
+    // PX output pixels of row y starting at x, for output blocks ob..ob+NB-1,
+    // with weights stored as W.
+    template<class W, int KH, int KW, int S, int NB, int PX>
+    inline void tile(const Args &a, int ob, int y, int x)
+    {
+        v8f acc[NB][PX];
+        for (int nb = 0; nb < NB; nb++)
+        {
+            const int c0 = (ob + nb) * BLOCK;
+            const v8f b  = (a.bias == nullptr) ? zero() :
+                           (a.nLayers - c0 >= BLOCK) ? load(a.bias + c0) :
+                           loadPartial(a.bias + c0, a.nLayers - c0);
+            for (int px = 0; px < PX; px++)
+                acc[nb][px] = b;
+        }
+
+        const float *in = a.input + (y * S) * a.inputRow + (x * S) * a.inputLanes;
+        const typename W::type *w = static_cast<const typename W::type*>(a.weights) + ob * a.weightBlock;
+        for (int d = 0; d < a.kernelD; d++, w += KH * KW * BLOCK)
+        {
+            const float *plane = in + (d / BLOCK) * a.inputBlock + d % BLOCK;
+            for (int kh = 0; kh < KH; kh++)
+            {
+                const float *row = plane + kh * a.inputRow;
+                for (int kw = 0; kw < KW; kw++)
+                {
+                    v8f wk[NB];
+                    for (int nb = 0; nb < NB; nb++)
+                        wk[nb] = W::load(w + nb * a.weightBlock + (kh * KW + kw) * BLOCK);
+                    for (int px = 0; px < PX; px++)
+                    {
+                        const v8f v = set1(row[(px * S + kw) * a.inputLanes]);
+                        for (int nb = 0; nb < NB; nb++)
+                            acc[nb][px] = fmadd(v, wk[nb], acc[nb][px]);
+                    }
+                }
+            }
+        }
+
+        for (int nb = 0; nb < NB; nb++)
+        {
+            float *out = a.output + (ob + nb) * a.outputBlock + y * a.outputRow + x * a.outputLanes;
+            for (int px = 0; px < PX; px++, out += a.outputLanes)
+            {
+                if (a.relu)
+                    acc[nb][px] = max(acc[nb][px], zero());
+                if (a.outputLanes == BLOCK)
+                    store(out, acc[nb][px]);
+                else
+                    storePartial(out, acc[nb][px], a.outputLanes);
+            }
+        }
+    }
+
+    // n pixels of row y from x: tiles of PX, then smaller tiles for the rest.
+    template<class W, int KH, int KW, int S, int NB, int PX>
+    inline void row(const Args &a, int ob, int y, int x, int n)
+    {
+        for (; n >= PX; x += PX, n -= PX)
+            tile<W, KH, KW, S, NB, PX>(a, ob, y, x);
+        if (PX > 1 && n > 0)
+            row<W, KH, KW, S, NB, (PX == 3 ? 1 : (PX + 1) / 2)>(a, ob, y, x, n);
+    }
+
+    template<int KH, int KW, int S>
+    Args arguments(const Tensor &input, const void *weights, const float *bias,
+                   Tensor &output, int kernelD, bool relu)
+    {
+        Args a;
+        a.input       = input.ptr();
+        a.inputBlock  = input.blockStep();
+        a.inputRow    = input.rowStep();
+        a.inputLanes  = input.lanes();
+        a.weights     = weights;
+        a.weightBlock = static_cast<size_t>(kernelD) * KH * KW * BLOCK;
+        a.bias        = bias;
+        a.output      = output.ptr();
+        a.outputBlock = output.blockStep();
+        a.outputRow   = output.rowStep();
+        a.outputLanes = output.lanes();
+        a.nLayers     = output.channels();
+        a.kernelD     = kernelD;
+        a.relu        = relu;
+        return a;
+    }
+
+    template<class W, int KH, int KW, int S>
+    void spatialKernel(const Tensor &input, const void *weights,
+                       const float *bias, Tensor &output, int kernelD, bool relu)
+    {
+        const Args a = arguments<KH, KW, S>(input, weights, bias, output, kernelD, relu);
+
+        const int outputW = output.cols();
+        const int outputH = output.rows();
+        const int blocks  = output.blocks();
+
+        // Two blocks x 6 pixels (or one block x 12) fill the register file;
+        // outputs too narrow for that trade pixels for blocks.
+        for (int ob = 0; ob < blocks; )
+        {
+            const int nb = (blocks - ob >= 4 && outputW < 6) ? 4 :
+                           (blocks - ob >= 2) ? 2 : 1;
+            for (int y = 0; y < outputH; y++)
+            {
+                if (nb == 4)
+                    row<W, KH, KW, S, 4, 3>(a, ob, y, 0, outputW);
+                else if (nb == 2)
+                    row<W, KH, KW, S, 2, 6>(a, ob, y, 0, outputW);
+                else
+                    row<W, KH, KW, S, 1, 12>(a, ob, y, 0, outputW);
+            }
+            ob += nb;
+        }
+    }
+
+    template<class W, int KH, int KW, int S>
+    void pooledKernel(const Tensor &input, const void *weights,
+                      const float *bias, Tensor &output, int kernelD,
+                      const Direct::Pool &pool, bool relu, Arena &scratch)
+    {
+        const int convW   = (input.cols() - KW) / S + 1;
+        const int convH   = (input.rows() - KH) / S + 1;
+        const int outputW = output.cols();
+        const int outputH = output.rows();
+        const int blocks  = output.blocks();
+        const int lanes   = output.lanes();
+        const int stripW  = (STRIP - 1) * pool.strideW + pool.width;
+
+        // One convolution row of the current strip per block, pooled
+        // horizontally as soon as it is produced into a ring of pool.height
+        // rows per block: [block][row % pool.height][x][8].
+        Args a = arguments<KH, KW, S>(input, weights, bias, output, kernelD, false);
+        a.outputLanes = BLOCK;
+        a.outputRow   = 0;
+        a.outputBlock = static_cast<size_t>(stripW) * BLOCK;
+        const size_t pooledRow   = STRIP * BLOCK;
+        const size_t pooledBlock = pool.height * pooledRow;
+        const size_t mark   = scratch.mark();
+        float *_conv        = scratch.allocate<float>(2 * a.outputBlock);
+        float *_ring        = scratch.allocate<float>(2 * pooledBlock);
+        float *_pooled      = scratch.allocate<float>(pooledRow);
+        const float **_rows = scratch.allocate<const float*>(pool.height);
+
+        for (int ob = 0; ob < blocks; )
+        {
+            const int nb = (blocks - ob >= 2) ? 2 : 1;
+            Args c = a;
+            c.weights = static_cast<const typename W::type*>(weights) + ob * a.weightBlock;
+            c.bias    = bias ? bias + ob * BLOCK : nullptr;
+            c.nLayers = a.nLayers - ob * BLOCK;
+            c.output  = &_conv[0];
+
+            for (int px0 = 0; px0 < outputW; px0 += STRIP)
+            {
+                const int px1 = std::min(px0 + STRIP, outputW);
+                const int cx0 = std::max(px0 * pool.strideW - pool.padW, 0);
+                const int cx1 = std::min((px1 - 1) * pool.strideW - pool.padW + pool.width, convW);
+                c.input = a.input + (cx0 * S) * a.inputLanes;
+
+                // The pooling window relative to the strip.
+                MaxPool::Window window = pool;
+                window.padW = std::max(pool.padW - px0 * pool.strideW, 0);
+
+                int next = 0;
+                for (int oy = 0; oy < outputH; oy++)
+                {
+                    const int wy0 = std::max(oy * pool.strideH - pool.padH, 0);
+                    const int wy1 = std::min(oy * pool.strideH - pool.padH + pool.height, convH);
+                    for (int r = std::max(next, wy0); r < wy1; r++)
+                    {
+                        if (nb == 2)
+                            row<W, KH, KW, S, 2, 6>(c, 0, r, 0, cx1 - cx0);
+                        else
+                            row<W, KH, KW, S, 1, 12>(c, 0, r, 0, cx1 - cx0);
+                        for (int b = 0; b < nb; b++)
+                            MaxPool::horizontal(&_conv[b * a.outputBlock], cx1 - cx0, BLOCK, window,
+                                                &_ring[b * pooledBlock + (r % pool.height) * pooledRow],
+                                                px1 - px0);
+                    }
+                    next = std::max(next, wy1);
+
+                    for (int b = 0; b < nb; b++)
+                    {
+                        for (int y = wy0; y < wy1; y++)
+                            _rows[y - wy0] = &_ring[b * pooledBlock + (y % pool.height) * pooledRow];
+                        float *out = output.ptr(ob + b, oy) + px0 * lanes;
+                        if (lanes == BLOCK)
+                        {
+                            MaxPool::vertical(&_rows[0], wy1 - wy0, out, (px1 - px0) * BLOCK, relu);
+                            continue;
+                        }
+                        MaxPool::vertical(&_rows[0], wy1 - wy0, &_pooled[0], (px1 - px0) * BLOCK, relu);
+                        for (int ox = 0; ox < px1 - px0; ox++)
+                            storePartial(out + ox * lanes, load(&_pooled[ox * BLOCK]), lanes);
+                    }
+                }
+            }
+            ob += nb;
+        }
+        scratch.release(mark);
+    }
+}
+
+namespace
+{
+    template<class W>
+    Direct::Kernel spatial(int kernelW, int kernelH, int strideW, int strideH)
+    {
+        if (kernelW != kernelH || strideW != strideH)
+            return nullptr;
+
+        switch (kernelW * 100 + strideW)
+        {
+            case 101:  return spatialKernel<W, 1, 1, 1>;
+            case 301:  return spatialKernel<W, 3, 3, 1>;
+            case 302:  return spatialKernel<W, 3, 3, 2>;
+            case 501:  return spatialKernel<W, 5, 5, 1>;
+            case 502:  return spatialKernel<W, 5, 5, 2>;
+            case 901:  return spatialKernel<W, 9, 9, 1>;
+            case 1001: return spatialKernel<W, 10, 10, 1>;
+            case 1801: return spatialKernel<W, 18, 18, 1>;
+            default:   return nullptr;
+        }
+    }
+
+    template<class W>
+    Direct::PooledKernel pooled(int kernelW, int kernelH, int strideW, int strideH)
+    {
+        if (kernelW != kernelH || strideW != strideH)
+            return nullptr;
+
+        switch (kernelW * 100 + strideW)
+        {
+            case 101:  return pooledKernel<W, 1, 1, 1>;
+            case 301:  return pooledKernel<W, 3, 3, 1>;
+            case 302:  return pooledKernel<W, 3, 3, 2>;
+            case 501:  return pooledKernel<W, 5, 5, 1>;
+            case 502:  return pooledKernel<W, 5, 5, 2>;
+            default:   return nullptr;
+        }
+    }
+
+    Direct::Kernel kernel(int kernelW, int kernelH, int strideW, int strideH, int format)
+    {
+        switch (format)
+        {
+            case Half::FP16: return spatial<Fp16>(kernelW, kernelH, strideW, strideH);
+            case Half::BF16: return spatial<Bf16>(kernelW, kernelH, strideW, strideH);
+            default:         return spatial<Fp32>(kernelW, kernelH, strideW, strideH);
+        }
+    }
+
+    Direct::PooledKernel pooled(int kernelW, int kernelH, int strideW, int strideH, int format)
+    {
+        switch (format)
+        {
+            case Half::FP16: return pooled<Fp16>(kernelW, kernelH, strideW, strideH);
+            case Half::BF16: return pooled<Bf16>(kernelW, kernelH, strideW, strideH);
+            default:         return pooled<Fp32>(kernelW, kernelH, strideW, strideH);
+        }
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindDirect(Kernels &kernels)
+        {
+            kernels.direct = kernel;
+            kernels.pooled = pooled;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+Direct::Kernel Direct::kernel(int kernelW, int kernelH, int strideW, int strideH, int format)
+{
+    return Isa::kernels().direct(kernelW, kernelH, strideW, strideH, format);
+}
+
+Direct::PooledKernel Direct::pooled(int kernelW, int kernelH, int strideW, int strideH, int format)
+{
+    return Isa::kernels().pooled(kernelW, kernelH, strideW, strideH, format);
+}
+
+size_t Direct::pooledScratch(const Pool &pool)
+{
+    const size_t stripW = static_cast<size_t>(STRIP - 1) * pool.strideW + pool.width;
+    return Arena::align(2 * stripW * BLOCK * sizeof(float)) +
+           Arena::align(2 * pool.height * STRIP * BLOCK * sizeof(float)) +
+           Arena::align(STRIP * BLOCK * sizeof(float)) +
+           Arena::align(pool.height * sizeof(const float*));
+}
+
+void Direct::blockWeights(int nLayers, int K, const float *weights, float *blocked)
+{
+    const int blocks = (nLayers + BLOCK - 1) / BLOCK;
+    for (int ob = 0; ob < blocks; ob++)
+        for (int k = 0; k < K; k++)
+            for (int l = 0; l < BLOCK; l++)
+            {
+                const int m = ob * BLOCK + l;
+                *blocked++ = (m < nLayers) ? weights[static_cast<size_t>(m) * K + k] : 0.f;
+            }
+}
+
+#endif
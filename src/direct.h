@@ -0,0 +1,96 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __direct__
+#define __direct__
+
+#include "tensor.h"
+#include "pool.h"
+#include "half.h"
+
+namespace cnn
+{
+    // Direct convolution on channel-blocked tensors, specialized at compile
+    // time on the kernel size and stride of the layers used by the cascade.
+    // A register tile holds up to 12 output pixels x 8 output channels: each
+    // input value is broadcast once and multiplied with whole blocks of
+    // weights, so nothing is gathered or reduced horizontally and the results
+    // land in the NCHWc output as they are.
+    //
+    // input   kernelD channels, unpadded (output = (input - kernel) / stride + 1)
+    // weights blocked per 8 output channels: [nLayers / 8][kernelD][kH][kW][8],
+    //         zero for the unused channels of a partial last block, stored
+    //         as floats or in the Half format the kernel was looked up for
+    // bias    nLayers values, or nullptr
+    // output  created by the caller with nLayers channels
+    // relu    clamps the results at zero
+    class Direct
+    {
+    public:
+        // Max pooling window applied to the convolution output.
+        typedef MaxPool::Window Pool;
+
+        typedef void (*Kernel)(const Tensor &input, const void *weights,
+                               const float *bias, Tensor &output, int kernelD,
+                               bool relu);
+
+        // Convolution and bias followed by max pooling (and ReLU, which
+        // commutes with it). The convolution output is produced in strips a
+        // few rows high that stay in L1 until they are pooled; output is the
+        // pooled map.
+        typedef void (*PooledKernel)(const Tensor &input, const void *weights,
+                                     const float *bias, Tensor &output, int kernelD,
+                                     const Pool &pool, bool relu, Arena &scratch);
+
+        // Specialized kernels for the given geometry, or nullptr if there is none.
+        static Kernel kernel(int kernelW, int kernelH, int strideW, int strideH,
+                             int format = Half::FP32);
+        static PooledKernel pooled(int kernelW, int kernelH, int strideW, int strideH,
+                                   int format = Half::FP32);
+
+        // Bytes of scratch a pooled kernel takes from the arena.
+        static size_t pooledScratch(const Pool &pool);
+
+        // Size in floats of the blocked weights.
+        static size_t blockedSize(int nLayers, int K)
+        {
+            return static_cast<size_t>((nLayers + Tensor::BLOCK - 1) / Tensor::BLOCK) * K * Tensor::BLOCK;
+        }
+
+        // Rearranges row-major weights[nLayers x K] into the blocked layout.
+        static void blockWeights(int nLayers, int K, const float *weights, float *blocked);
+    };
+}
+
+#endif
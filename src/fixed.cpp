@@ -0,0 +1,66 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include "fixed.h"
+#include "direct.h"
+
+using namespace cnn;
+
+void fixed::Weights::load(const CNNLayer &layer, int nLayers, int kernelD, int kernelW, int kernelH)
+{
+    const int K = kernelD * kernelW * kernelH;
+    CV_Assert(layer.type == CNNOpType::CONV || layer.type == CNNOpType::FC);
+    CV_Assert(static_cast<int>(layer.bias.size()) == nLayers &&
+              static_cast<int>(layer.weights.size()) == nLayers * kernelD &&
+              layer.weights[0].cols == kernelW && layer.weights[0].rows == kernelH);
+    if (layer.type == CNNOpType::CONV)
+        CV_Assert(layer.params.at(CNNStringParam::StrideW) == 1 && layer.params.at(CNNStringParam::StrideH) == 1 &&
+                  layer.params.at(CNNStringParam::PadW) == 0 && layer.params.at(CNNStringParam::PadH) == 0);
+
+    // matrix holds Half codes for 16-bit weight formats.
+    Mat _matrix = layer.matrix;
+    if (_matrix.depth() != CV_32F)
+    {
+        _matrix.create(nLayers, K, CV_32F);
+        for (int r = 0; r < nLayers; r++)
+            Half::widen(layer.matrix.ptr<uint16_t>(r), K, layer.weightFormat(), _matrix.ptr<float>(r));
+    }
+
+    const int blocks = (nLayers + Tensor::BLOCK - 1) / Tensor::BLOCK;
+    blocked.create(1, static_cast<int>(Direct::blockedSize(nLayers, K)), CV_32F);
+    Direct::blockWeights(nLayers, K, _matrix.ptr<float>(), blocked.ptr<float>());
+    bias = Mat::zeros(1, blocks * Tensor::BLOCK, CV_32F);
+    for (int i = 0; i < nLayers; i++)
+        bias.at<float>(i) = layer.bias[i];
+}
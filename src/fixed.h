@@ -0,0 +1,482 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __fixed__
+#define __fixed__
+
+#include <limits>
+#include "cnn.h"
+#include "simd.h"
+
+namespace cnn
+{
+    // Networks whose topology and input size are template arguments, an
+    // alternative to CNN for the stages that always see the same input (the
+    // 48x48 crops of the second stage). Every shape, loop bound and buffer
+    // size is a compile-time constant, so the compiler unrolls and schedules
+    // the kernels for the exact layer and the activations fit one arena
+    // block sized up front. Weights are copied from a loaded CNN.
+    //
+    //     typedef FixedCNN<fixed::Shape<1, 48, 48>,
+    //                      fixed::Conv<5, 5, 64>, fixed::Pool<3, 2, 1>, fixed::Relu,
+    //                      ...> Net;
+    //     Net net;
+    //     net.load(cnn);
+    //     net.forward(crop, output);
+    //
+    // Activations use the channel-blocked layout of Tensor.
+    namespace fixed
+    {
+        // C channels of H x W pixels, laid out as a Tensor of that shape.
+        template<int C, int H, int W>
+        struct Shape
+        {
+            static constexpr int CHANNELS   = C;
+            static constexpr int ROWS       = H;
+            static constexpr int COLS       = W;
+            static constexpr int LANES      = (C < Tensor::BLOCK) ? C : Tensor::BLOCK;
+            static constexpr int BLOCKS     = (C + Tensor::BLOCK - 1) / Tensor::BLOCK;
+            static constexpr int BLOCK_STEP = (H * W * LANES + 15) / 16 * 16;
+            static constexpr int SIZE       = BLOCK_STEP * BLOCKS;    // floats
+        };
+
+        // Weights and bias of a CONV/FC, blocked per 8 output channels like
+        // Direct's and zero-padded to whole blocks.
+        struct Weights
+        {
+            Mat blocked;
+            Mat bias;
+
+            // Copies layer, checking its geometry against the template's.
+            void load(const CNNLayer &layer, int nLayers, int kernelD, int kernelW, int kernelH);
+        };
+
+        // Every layer has an Output shape for its input shape In, loads its
+        // weights (if WEIGHTED) from the next CONV/FC layer and runs from an
+        // In buffer into an Output buffer, clamping at zero when RELU (a Relu
+        // right after it is folded in).
+        //
+        // KW x KH convolution, stride 1, no padding.
+        template<int KW, int KH, int N> struct Conv;
+        // Convolution over the whole input: a 1 x 1 output of N channels.
+        template<int N> struct FC;
+        // K x K max pooling with stride S and padding P.
+        template<int K, int S, int P> struct Pool;
+        struct Relu;
+        // Softmax over the channels of every pixel, or the CNNHead of a
+        // two-class output.
+        struct Softmax;
+
+        namespace detail
+        {
+            using namespace simd;
+
+            // PX output pixels of row y from x for output blocks ob..ob+NB-1.
+            template<class In, class Out, int KW, int KH, bool RELU, int NB, int PX>
+            inline void tile(const float *in, const float *weights, const float *bias,
+                             float *out, int ob, int y, int x)
+            {
+                enum { K = In::CHANNELS * KH * KW, BLOCK = Tensor::BLOCK };
+
+                v8f acc[NB][PX];
+                for (int nb = 0; nb < NB; nb++)
+                {
+                    const v8f b = load(bias + (ob + nb) * BLOCK);
+                    for (int px = 0; px < PX; px++)
+                        acc[nb][px] = b;
+                }
+
+                const float *src = in + (y * In::COLS + x) * In::LANES;
+                const float *w   = weights + ob * K * BLOCK;
+                for (int d = 0; d < In::CHANNELS; d++)
+                {
+                    const float *plane = src + (d / BLOCK) * In::BLOCK_STEP + d % BLOCK;
+                    for (int kh = 0; kh < KH; kh++)
+                        for (int kw = 0; kw < KW; kw++)
+                        {
+                            v8f wk[NB];
+                            for (int nb = 0; nb < NB; nb++)
+                                wk[nb] = load(w + nb * K * BLOCK + ((d * KH + kh) * KW + kw) * BLOCK);
+                            for (int px = 0; px < PX; px++)
+                            {
+                                const v8f v = set1(plane[(kh * In::COLS + px + kw) * In::LANES]);
+                                for (int nb = 0; nb < NB; nb++)
+                                    acc[nb][px] = fmadd(v, wk[nb], acc[nb][px]);
+                            }
+                        }
+                }
+
+                for (int nb = 0; nb < NB; nb++)
+                {
+                    float *dst = out + (ob + nb) * Out::BLOCK_STEP + (y * Out::COLS + x) * Out::LANES;
+                    for (int px = 0; px < PX; px++, dst += Out::LANES)
+                    {
+                        const v8f v = RELU ? max(acc[nb][px], zero()) : acc[nb][px];
+                        if (Out::LANES == BLOCK)
+                            store(dst, v);
+                        else
+                            storePartial(dst, v, Out::LANES);
+                    }
+                }
+            }
+
+            // Output blocks [ob, ob + NB) over the whole map: tiles of PX
+            // pixels, then one tile for the rest of each row.
+            template<class In, class Out, int KW, int KH, bool RELU, int NB, int PX>
+            inline void blocks(const float *in, const float *weights, const float *bias,
+                               float *out, int ob)
+            {
+                enum { TILES = Out::COLS / PX, REST = Out::COLS % PX };
+                for (int y = 0; y < Out::ROWS; y++)
+                {
+                    for (int t = 0; t < TILES; t++)
+                        tile<In, Out, KW, KH, RELU, NB, PX>(in, weights, bias, out, ob, y, t * PX);
+                    if (REST > 0)
+                        tile<In, Out, KW, KH, RELU, NB, (REST > 0 ? REST : 1)>(in, weights, bias, out,
+                                                                               ob, y, TILES * PX);
+                }
+            }
+
+            // Two blocks x 6 pixels (or one block x 12) fill the register
+            // file; outputs narrower than that take four blocks at a time.
+            template<class In, class Out, int KW, int KH, bool RELU>
+            inline void convolve(const float *in, const Weights &weights, float *out)
+            {
+                enum
+                {
+                    NB = (Out::COLS < 6) ? 4 : 2,
+                    PX = (Out::COLS < 6) ? ((Out::COLS < 3) ? Out::COLS : 3) : 6,
+                    GROUPS = Out::BLOCKS / NB
+                };
+                const float *w = weights.blocked.ptr<float>();
+                const float *b = weights.bias.ptr<float>();
+                for (int g = 0; g < GROUPS; g++)
+                    blocks<In, Out, KW, KH, RELU, NB, PX>(in, w, b, out, g * NB);
+                for (int ob = GROUPS * NB; ob < Out::BLOCKS; ob++)
+                    blocks<In, Out, KW, KH, RELU, 1, 2 * PX>(in, w, b, out, ob);
+            }
+        }
+
+        template<int KW, int KH, int N>
+        struct Conv
+        {
+            static constexpr int WEIGHTED = 1;
+            template<class In>
+            using Output = Shape<N, In::ROWS - KH + 1, In::COLS - KW + 1>;
+
+            template<class In>
+            static void loadWeights(Weights *weights, const CNNLayer *const *layers)
+            {
+                weights->load(**layers, N, In::CHANNELS, KW, KH);
+            }
+
+            template<class In, bool RELU>
+            static void run(const float *in, float *out, const Weights *weights, int)
+            {
+                detail::convolve<In, Output<In>, KW, KH, RELU>(in, *weights, out);
+            }
+        };
+
+        template<int N>
+        struct FC
+        {
+            static constexpr int WEIGHTED = 1;
+            template<class In>
+            using Output = Shape<N, 1, 1>;
+
+            template<class In>
+            static void loadWeights(Weights *weights, const CNNLayer *const *layers)
+            {
+                weights->load(**layers, N, In::CHANNELS, In::COLS, In::ROWS);
+            }
+
+            template<class In, bool RELU>
+            static void run(const float *in, float *out, const Weights *weights, int)
+            {
+                detail::convolve<In, Output<In>, In::COLS, In::ROWS, RELU>(in, *weights, out);
+            }
+        };
+
+        template<int K, int S, int P>
+        struct Pool
+        {
+            static constexpr int WEIGHTED = 0;
+            template<class In>
+            static void loadWeights(Weights*, const CNNLayer *const*) {}
+            template<class In>
+            using Output = Shape<In::CHANNELS, (In::ROWS + 2 * P - K) / S + 1, (In::COLS + 2 * P - K) / S + 1>;
+
+            // Windows are clipped at the borders, as in MaxPool.
+            template<class In, bool RELU>
+            static void run(const float *in, float *out, const Weights*, int)
+            {
+                using namespace simd;
+                typedef Output<In> Out;
+                static_assert(In::LANES == Tensor::BLOCK, "pooling needs whole blocks of channels");
+
+                for (int b = 0; b < In::BLOCKS; b++)
+                    for (int oy = 0; oy < Out::ROWS; oy++)
+                    {
+                        const int y0 = std::max(oy * S - P, 0);
+                        const int y1 = std::min(oy * S - P + K, static_cast<int>(In::ROWS));
+                        for (int ox = 0; ox < Out::COLS; ox++)
+                        {
+                            const int x0 = std::max(ox * S - P, 0);
+                            const int x1 = std::min(ox * S - P + K, static_cast<int>(In::COLS));
+                            v8f m = set1(std::numeric_limits<float>::lowest());
+                            for (int y = y0; y < y1; y++)
+                                for (int x = x0; x < x1; x++)
+                                    m = max(m, load(in + b * In::BLOCK_STEP + (y * In::COLS + x) * Tensor::BLOCK));
+                            if (RELU)
+                                m = max(m, zero());
+                            store(out + b * Out::BLOCK_STEP + (oy * Out::COLS + ox) * Tensor::BLOCK, m);
+                        }
+                    }
+            }
+        };
+
+        struct Relu
+        {
+            static constexpr int WEIGHTED = 0;
+            template<class In>
+            static void loadWeights(Weights*, const CNNLayer *const*) {}
+            template<class In>
+            using Output = In;
+
+            template<class In, bool RELU>
+            static void run(const float *in, float *out, const Weights*, int)
+            {
+                using namespace simd;
+                for (int i = 0; i < In::SIZE; i += Tensor::BLOCK)
+                    store(out + i, max(load(in + i), zero()));
+            }
+        };
+
+        struct Softmax
+        {
+            static constexpr int WEIGHTED = 0;
+            template<class In>
+            static void loadWeights(Weights*, const CNNLayer *const*) {}
+            template<class In>
+            using Output = In;
+
+            // With a two-class SIGMOID or LOGIT head the output has one
+            // channel, as in Op::SOFTMAX.
+            template<class In, bool RELU>
+            static void run(const float *in, float *out, const Weights*, int head)
+            {
+                enum { PIXELS = In::ROWS * In::COLS, BLOCK = Tensor::BLOCK };
+                for (int p = 0; p < PIXELS; p++)
+                {
+                    float v[In::CHANNELS];
+                    for (int c = 0; c < In::CHANNELS; c++)
+                        v[c] = in[(c / BLOCK) * In::BLOCK_STEP + p * In::LANES + c % BLOCK];
+
+                    if (In::CHANNELS == 2 && head != CNNHead::SOFTMAX)
+                    {
+                        const float d = v[0] - v[In::CHANNELS - 1];
+                        out[p] = (head == CNNHead::LOGIT) ? d : 1.f / (1.f + std::exp(-d));
+                        continue;
+                    }
+
+                    float m = v[0], s = 0.f;
+                    for (int c = 1; c < In::CHANNELS; c++)
+                        m = std::max(m, v[c]);
+                    for (int c = 0; c < In::CHANNELS; c++)
+                        s += (v[c] = std::exp(v[c] - m));
+                    for (int c = 0; c < In::CHANNELS; c++)
+                        out[(c / BLOCK) * In::BLOCK_STEP + p * In::LANES + c % BLOCK] = v[c] / s;
+                }
+            }
+        };
+
+        // The layers from input shape In: output shape, weighted layers and
+        // the largest activation, and the pass itself. Layers write to out
+        // and spare in turn; run returns the buffer holding the result.
+        template<class In, class... Layers>
+        struct Chain
+        {
+            typedef In Output;
+            static constexpr int WEIGHTED = 0;
+            static constexpr int SIZE     = 0;
+
+            static void loadWeights(Weights*, const CNNLayer *const*) {}
+            static const float *run(const float *in, float*, float*, const Weights*, int)
+            {
+                return in;
+            }
+        };
+
+        template<class In, class L, class... Layers>
+        struct Chain<In, L, Layers...>
+        {
+            typedef typename L::template Output<In> Out;
+            typedef Chain<Out, Layers...> Next;
+            typedef typename Next::Output Output;
+            static constexpr int WEIGHTED = L::WEIGHTED + Next::WEIGHTED;
+            static constexpr int SIZE     = (Out::SIZE > Next::SIZE) ? Out::SIZE : Next::SIZE;
+
+            static void loadWeights(Weights *weights, const CNNLayer *const *layers)
+            {
+                L::template loadWeights<In>(weights, layers);
+                Next::loadWeights(weights + L::WEIGHTED, layers + L::WEIGHTED);
+            }
+
+            static const float *run(const float *in, float *out, float *spare,
+                                    const Weights *weights, int head)
+            {
+                L::template run<In, false>(in, out, weights, head);
+                return Next::run(out, spare, out, weights + L::WEIGHTED, head);
+            }
+        };
+
+        // A layer followed by a Relu applies it itself.
+        template<class In, class L, class... Layers>
+        struct Chain<In, L, Relu, Layers...>
+        {
+            typedef typename L::template Output<In> Out;
+            typedef Chain<Out, Layers...> Next;
+            typedef typename Next::Output Output;
+            static constexpr int WEIGHTED = L::WEIGHTED + Next::WEIGHTED;
+            static constexpr int SIZE     = (Out::SIZE > Next::SIZE) ? Out::SIZE : Next::SIZE;
+
+            static void loadWeights(Weights *weights, const CNNLayer *const *layers)
+            {
+                L::template loadWeights<In>(weights, layers);
+                Next::loadWeights(weights + L::WEIGHTED, layers + L::WEIGHTED);
+            }
+
+            static const float *run(const float *in, float *out, float *spare,
+                                    const Weights *weights, int head)
+            {
+                L::template run<In, true>(in, out, weights, head);
+                return Next::run(out, spare, out, weights + L::WEIGHTED, head);
+            }
+        };
+    }
+
+    template<class In, class... Layers>
+    class FixedCNN
+    {
+    public:
+        typedef fixed::Chain<In, Layers...> Chain;
+        typedef typename Chain::Output Output;
+
+        enum
+        {
+            // Bytes of arena a pass takes: the input and two activations.
+            ARENA_SIZE = (In::SIZE + 2 * Chain::SIZE) * sizeof(float)
+        };
+
+        FixedCNN(): _head(CNNHead::SOFTMAX) {}
+
+        // Copies the weights of the CONV and FC layers of net, in order, and
+        // the head of its last layer. The other layers of net are expected
+        // to match the template's, up to RELUs it drops as redundant.
+        void load(const CNN &net)
+        {
+            vector<const CNNLayer*> weighted;
+            for (size_t i = 0; i < net.size(); i++)
+            {
+                const CNNLayer &layer = net.getLayer(i);
+                if (layer.type == CNNOpType::CONV || layer.type == CNNOpType::FC)
+                    weighted.push_back(&layer);
+            }
+            CV_Assert(weighted.size() == static_cast<size_t>(Chain::WEIGHTED));
+            Chain::loadWeights(_weights, weighted.data());
+            _head = net.size() ? net.getLayer(net.size() - 1).head() : CNNHead::SOFTMAX;
+        }
+
+        void setHead(int head) { _head = head; }
+
+        // Same interface and concurrency contract as CNN::forward, for
+        // inputs of exactly In's shape.
+        void forward(const Mat &input, vector<Mat> &output) const
+        {
+            Workspace _workspace;
+            forward(input, output, _workspace);
+        }
+
+        void forward(const Mat &input, vector<Mat> &output, Workspace &workspace) const
+        {
+            Arena &arena = workspace.arena;
+            CV_Assert(input.rows == In::ROWS && input.cols == In::COLS &&
+                      input.channels() == In::CHANNELS);
+            arena.reset();
+            arena.reserve(ARENA_SIZE);
+
+            Tensor _input;
+            _input.create(In::CHANNELS, In::ROWS, In::COLS, arena);
+            _input.fromMat(input);
+            float *a = arena.allocate<float>(Chain::SIZE);
+            float *b = arena.allocate<float>(Chain::SIZE);
+            const float *result = Chain::run(_input.ptr(), a, b, _weights, _head);
+
+            const bool folded = (Output::CHANNELS == 2 && _head != CNNHead::SOFTMAX);
+            Tensor _output;
+            _output.create(folded ? 1 : static_cast<int>(Output::CHANNELS), Output::ROWS, Output::COLS,
+                           const_cast<float*>(result));
+            _output.toPlanes(output);
+        }
+
+        // The batched interface of CNN::forward, run input by input.
+        void forward(const vector<Mat> &inputs, vector<vector<Mat> > &outputs,
+                     Workspace &workspace) const
+        {
+            outputs.resize(inputs.size());
+            for (size_t n = 0; n < inputs.size(); n++)
+                forward(inputs[n], outputs[n], workspace);
+        }
+
+    private:
+        fixed::Weights _weights[Chain::WEIGHTED];
+        int            _head;
+    };
+
+    // The second stage of the cascade; 48net without the RELU after its
+    // second max-pool, whose input is already non-negative.
+    typedef FixedCNN<fixed::Shape<1, 48, 48>,
+                     fixed::Conv<5, 5, 64>, fixed::Pool<3, 2, 1>, fixed::Relu,
+                     fixed::Conv<5, 5, 64>, fixed::Relu, fixed::Pool<3, 2, 1>,
+                     fixed::FC<128>, fixed::Relu,
+                     fixed::FC<2>, fixed::Softmax> FixedCNN48;
+
+    typedef FixedCNN<fixed::Shape<1, 48, 48>,
+                     fixed::Conv<5, 5, 64>, fixed::Pool<3, 2, 1>, fixed::Relu,
+                     fixed::Conv<5, 5, 64>,
+                     fixed::FC<256>, fixed::Relu,
+                     fixed::FC<45>, fixed::Softmax> FixedCNN48Calibration;
+}
+
+#endif
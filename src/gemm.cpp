@@ -0,0 +1,338 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <cstring>
+#include <algorithm>
+#include "gemm.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+using namespace cnn::simd;
+
+namespace
+{
+    const int MR = Gemm::MR;
+    const int NR = Gemm::NR;
+    const int KC = Gemm::KC;
+    const int NC = Gemm::NC;
+
+    void packB(int kc, int nc, const float *B, int ldb, float *packedB)
+    {
+        for (int jr = 0; jr < nc; jr += NR)
+        {
+            const int nr = std::min<int>(NR, nc - jr);
+            for (int k = 0; k < kc; k++)
+            {
+                const float *src = B + k * ldb + jr;
+                int j = 0;
+                for (; j < nr; j++)
+                    *packedB++ = src[j];
+                for (; j < NR; j++)
+                    *packedB++ = 0.f;
+            }
+        }
+    }
+
+    void microKernel(int kc,
+                     const float *a,
+                     const float *b,
+                     float *C, int ldc,
+                     int mr, int nr,
+                     bool accumulate)
+    {
+        v8f c[MR][NR / 8];
+        for (int i = 0; i < MR; i++)
+            c[i][0] = c[i][1] = zero();
+
+        for (int k = 0; k < kc; k++, a += MR, b += NR)
+        {
+            const v8f b0 = load(b);
+            const v8f b1 = load(b + 8);
+            for (int i = 0; i < MR; i++)
+            {
+                const v8f _a = set1(a[i]);
+                c[i][0] = fmadd(_a, b0, c[i][0]);
+                c[i][1] = fmadd(_a, b1, c[i][1]);
+            }
+        }
+
+        if (nr == NR)
+        {
+            for (int i = 0; i < mr; i++)
+            {
+                float *row = C + i * ldc;
+                if (accumulate)
+                {
+                    c[i][0] = add(c[i][0], load(row));
+                    c[i][1] = add(c[i][1], load(row + 8));
+                }
+                store(row, c[i][0]);
+                store(row + 8, c[i][1]);
+            }
+            return;
+        }
+
+        float _c[NR];
+        for (int i = 0; i < mr; i++)
+        {
+            float *row = C + i * ldc;
+            store(_c, c[i][0]);
+            store(_c + 8, c[i][1]);
+            if (accumulate)
+                for (int j = 0; j < nr; j++)
+                    row[j] += _c[j];
+            else
+                for (int j = 0; j < nr; j++)
+                    row[j] = _c[j];
+        }
+    }
+
+    void macroKernel(int M, int nc, int kc,
+                     const float *packedA,
+                     const float *packedB,
+                     float *C, int ldc,
+                     bool accumulate)
+    {
+        for (int jr = 0; jr < nc; jr += NR)
+        {
+            const int nr     = std::min<int>(NR, nc - jr);
+            const float *b   = packedB + static_cast<size_t>(jr) * kc;
+            for (int ir = 0; ir < M; ir += MR)
+            {
+                const int mr   = std::min<int>(MR, M - ir);
+                const float *a = packedA + static_cast<size_t>(ir) * kc;
+                microKernel(kc, a, b, C + ir * ldc + jr, ldc, mr, nr, accumulate);
+            }
+        }
+    }
+
+    void sgemm(int M, int N, int K,
+               const float *packedA,
+               const float *B, int ldb,
+               float *C, int ldc,
+               bool accumulate)
+    {
+        const int Mr = Gemm::roundUp(M, MR);
+        std::vector<float> packedB(Gemm::packedBSize(std::min<int>(KC, K), std::min<int>(NC, N)));
+
+        for (int jc = 0; jc < N; jc += NC)
+        {
+            const int nc = std::min<int>(NC, N - jc);
+            for (int pc = 0; pc < K; pc += KC)
+            {
+                const int kc = std::min<int>(KC, K - pc);
+                packB(kc, nc, B + pc * ldb + jc, ldb, &packedB[0]);
+                macroKernel(M, nc, kc,
+                            packedA + static_cast<size_t>(Mr) * pc,
+                            &packedB[0],
+                            C + jc, ldc,
+                            accumulate || pc > 0);
+            }
+        }
+    }
+
+    // First n (< 8) elements of p, zero elsewhere.
+    template<class W>
+    inline v8f loadPartialAs(const typename W::type *p, int n)
+    {
+        typename W::type tail[8] = {};
+        for (int i = 0; i < n; i++)
+            tail[i] = p[i];
+        return W::load(tail);
+    }
+
+    template<class W>
+    void gemv(int M, int K,
+              const typename W::type *A, size_t lda,
+              const float *x,
+              float *y)
+    {
+        // Elements ahead of the current position prefetched in every row.
+        const int DISTANCE = 1024;
+
+        int m = 0;
+        for (; m + 4 <= M; m += 4)
+        {
+            const typename W::type *a[4] = {A + m * lda, A + (m + 1) * lda, A + (m + 2) * lda, A + (m + 3) * lda};
+            v8f c[4][2];
+            for (int i = 0; i < 4; i++)
+                c[i][0] = c[i][1] = zero();
+
+            int k = 0;
+            for (; k + 16 <= K; k += 16)
+            {
+                const v8f x0 = load(x + k);
+                const v8f x1 = load(x + k + 8);
+                for (int i = 0; i < 4; i++)
+                {
+                    prefetch(reinterpret_cast<const float*>(a[i] + k + DISTANCE));
+                    c[i][0] = fmadd(W::load(a[i] + k), x0, c[i][0]);
+                    c[i][1] = fmadd(W::load(a[i] + k + 8), x1, c[i][1]);
+                }
+            }
+            for (; k < K; k += 8)
+            {
+                const int n  = std::min(8, K - k);
+                const v8f x0 = (n == 8) ? load(x + k) : loadPartial(x + k, n);
+                for (int i = 0; i < 4; i++)
+                    c[i][0] = fmadd((n == 8) ? W::load(a[i] + k) : loadPartialAs<W>(a[i] + k, n), x0, c[i][0]);
+            }
+            for (int i = 0; i < 4; i++)
+                y[m + i] += hsum(add(c[i][0], c[i][1]));
+        }
+
+        for (; m < M; m++)
+        {
+            const typename W::type *a = A + m * lda;
+            v8f c = zero();
+            for (int k = 0; k < K; k += 8)
+            {
+                const int n = std::min(8, K - k);
+                c = fmadd((n == 8) ? W::load(a + k) : loadPartialAs<W>(a + k, n),
+                          (n == 8) ? load(x + k) : loadPartial(x + k, n), c);
+            }
+            y[m] += hsum(c);
+        }
+    }
+
+    void sgemv(int M, int K,
+               const float *A, size_t lda,
+               const float *x,
+               float *y)
+    {
+        gemv<Fp32>(M, K, A, lda, x, y);
+    }
+
+    void hgemv(int M, int K,
+               const uint16_t *A, size_t lda,
+               int format,
+               const float *x,
+               float *y)
+    {
+        if (format == Half::BF16)
+            gemv<Bf16>(M, K, A, lda, x, y);
+        else
+            gemv<Fp16>(M, K, A, lda, x, y);
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindGemm(Kernels &kernels)
+        {
+            kernels.packB       = packB;
+            kernels.macroKernel = macroKernel;
+            kernels.sgemm       = sgemm;
+            kernels.sgemv       = sgemv;
+            kernels.hgemv       = hgemv;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+size_t Gemm::packedASize(int M, int K)
+{
+    return static_cast<size_t>(roundUp(M, MR)) * K;
+}
+
+size_t Gemm::packedBSize(int kc, int nc)
+{
+    return static_cast<size_t>(roundUp(nc, NR)) * kc;
+}
+
+void Gemm::packA(int M, int K, const float *A, int lda, float *packedA)
+{
+    const int Mr = roundUp(M, MR);
+    for (int pc = 0; pc < K; pc += KC)
+    {
+        const int kc = std::min<int>(KC, K - pc);
+        float *dst   = packedA + static_cast<size_t>(Mr) * pc;
+        for (int ir = 0; ir < Mr; ir += MR)
+        {
+            for (int k = 0; k < kc; k++)
+            {
+                for (int i = 0; i < MR; i++)
+                {
+                    *dst++ = (ir + i < M) ? A[(ir + i) * lda + pc + k] : 0.f;
+                }
+            }
+        }
+    }
+}
+
+void Gemm::packB(int kc, int nc, const float *B, int ldb, float *packedB)
+{
+    Isa::kernels().packB(kc, nc, B, ldb, packedB);
+}
+
+void Gemm::macroKernel(int M, int nc, int kc,
+                       const float *packedA,
+                       const float *packedB,
+                       float *C, int ldc,
+                       bool accumulate)
+{
+    Isa::kernels().macroKernel(M, nc, kc, packedA, packedB, C, ldc, accumulate);
+}
+
+void Gemm::sgemm(int M, int N, int K,
+                 const float *packedA,
+                 const float *B, int ldb,
+                 float *C, int ldc,
+                 bool accumulate)
+{
+    Isa::kernels().sgemm(M, N, K, packedA, B, ldb, C, ldc, accumulate);
+}
+
+void Gemm::sgemv(int M, int K,
+                 const float *A, size_t lda,
+                 const float *x,
+                 float *y)
+{
+    Isa::kernels().sgemv(M, K, A, lda, x, y);
+}
+
+void Gemm::hgemv(int M, int K,
+                 const uint16_t *A, size_t lda,
+                 int format,
+                 const float *x,
+                 float *y)
+{
+    Isa::kernels().hgemv(M, K, A, lda, format, x, y);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __gemm__
+#define __gemm__
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace cnn
+{
+    // Cache-blocked, register-tiled single precision GEMM used by the
+    // convolution engine. A (the layer weights) is packed once into MR-row
+    // panels; B (the im2col patches) is packed per KC x NC block into
+    // NR-column panels, so the micro-kernel only ever streams contiguous memory.
+    class Gemm
+    {
+    public:
+        enum
+        {
+            MR = 6,     // rows of C held in registers by the micro-kernel
+            NR = 16,    // columns of C held in registers by the micro-kernel
+            KC = 256,   // depth of a packed block (B panel of KC x NR stays in L1)
+            NC = 512    // columns of B packed per block
+        };
+
+        static int roundUp(int value, int multiple)
+        {
+            return ((value + multiple - 1) / multiple) * multiple;
+        }
+
+        // Size in floats of A[M x K] once packed.
+        static size_t packedASize(int M, int K);
+        // Size in floats of a packed B block of kc x nc.
+        static size_t packedBSize(int kc, int nc);
+
+        // Packs row-major A[M x K] for every KC block of K. The block starting
+        // at pc lives at packedA + roundUp(M, MR) * pc.
+        static void packA(int M, int K, const float *A, int lda, float *packedA);
+
+        // Packs the kc x nc row-major block of B into NR-column panels.
+        static void packB(int kc, int nc, const float *B, int ldb, float *packedB);
+
+        // C[M x nc] (+)= packedA block * packedB block.
+        static void macroKernel(int M, int nc, int kc,
+                                const float *packedA,
+                                const float *packedB,
+                                float *C, int ldc,
+                                bool accumulate);
+
+        // C[M x N] (+)= A[M x K] * B[K x N] with A already packed by packA.
+        static void sgemm(int M, int N, int K,
+                          const float *packedA,
+                          const float *B, int ldb,
+                          float *C, int ldc,
+                          bool accumulate = false);
+
+        // y[M] += A[M x K] * x[K] for a row-major A. Meant for the FC layers,
+        // which are bound by streaming A: rows are read four at a time in
+        // one pass and prefetched ahead.
+        static void sgemv(int M, int K,
+                          const float *A, size_t lda,
+                          const float *x,
+                          float *y);
+
+        // sgemv on an A stored as fp16 or bf16 (Half), widened as it is
+        // streamed, which halves the bytes read.
+        static void hgemv(int M, int K,
+                          const uint16_t *A, size_t lda,
+                          int format,
+                          const float *x,
+                          float *y);
+    };
+}
+
+#endif
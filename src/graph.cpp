@@ -0,0 +1,289 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include "graph.h"
+
+using namespace cnn;
+
+CNNStep Graph::lower(const CNNLayer &layer, size_t index)
+{
+    CNNStep step = CNNStep();
+    step.layer        = index;
+    step.algorithm    = layer.algorithm();
+    step.weightFormat = layer.weightFormat();
+    step.head         = layer.head();
+
+    if (layer.type == CNNOpType::CONV || layer.type == CNNOpType::FC)
+    {
+        const bool conv = (layer.type == CNNOpType::CONV);
+        step.op      = conv ? CNNStep::CONV : CNNStep::FC;
+        step.nLayers = static_cast<int>(layer.params.at(CNNStringParam::NLayers));
+        step.kernelD = static_cast<int>(layer.weights.size()) / step.nLayers;
+        step.kernelW = layer.weights[0].cols;
+        step.kernelH = layer.weights[0].rows;
+        step.strideW = conv ? static_cast<int>(layer.params.at(CNNStringParam::StrideW)) : 1;
+        step.strideH = conv ? static_cast<int>(layer.params.at(CNNStringParam::StrideH)) : 1;
+        step.padW    = conv ? static_cast<int>(layer.params.at(CNNStringParam::PadW)) : 0;
+        step.padH    = conv ? static_cast<int>(layer.params.at(CNNStringParam::PadH)) : 0;
+
+        if (layer.params.count(CNNStringParam::QuantScale))
+        {
+            step.activation.scale = layer.params.at(CNNStringParam::QuantScale);
+            step.activation.zero  = static_cast<int>(layer.params.at(CNNStringParam::QuantZero));
+        }
+
+        if (!layer.blocked.empty())
+            step.direct = Direct::kernel(step.kernelW, step.kernelH, step.strideW, step.strideH,
+                                         step.weightFormat);
+        if (conv && step.direct != nullptr)
+            step.pooled = Direct::pooled(step.kernelW, step.kernelH, step.strideW, step.strideH,
+                                         step.weightFormat);
+        // The reference path and GEMM need float weights.
+        step.reference = (layer.matrix.depth() == CV_32F);
+        step.gemm      = !layer.packed.empty();
+        step.winograd  = !layer.winograd2x2.empty() && !layer.winograd4x4.empty();
+        step.int8      = !layer.quantized.empty();
+    }
+    else if (layer.type == CNNOpType::RELU)
+        step.op = CNNStep::RELU;
+    else if (layer.type == CNNOpType::SOFTMAX)
+        step.op = CNNStep::SOFTMAX;
+    else if (layer.type == CNNOpType::MAXPOOL)
+    {
+        step.op = CNNStep::MAXPOOL;
+        step.window.width   = static_cast<int>(layer.params.at(CNNStringParam::KernelW));
+        step.window.height  = static_cast<int>(layer.params.at(CNNStringParam::KernelH));
+        step.window.strideW = static_cast<int>(layer.params.at(CNNStringParam::StrideW));
+        step.window.strideH = static_cast<int>(layer.params.at(CNNStringParam::StrideH));
+        step.window.padW    = static_cast<int>(layer.params.at(CNNStringParam::PadW));
+        step.window.padH    = static_cast<int>(layer.params.at(CNNStringParam::PadH));
+    }
+    else
+        CV_Error(Error::StsNotImplemented, "no forward op for layer type " + layer.type);
+
+    return step;
+}
+
+void Graph::optimize(vector<CNNStep> &steps, const vector<CNNLayer> &layers)
+{
+    eliminateRelu(steps);
+    placeRelu(steps);
+    foldHead(steps, layers);
+}
+
+void Graph::eliminateRelu(vector<CNNStep> &steps)
+{
+    bool nonNegative = false;
+    for (size_t i = 0; i < steps.size(); )
+    {
+        const CNNStep &step = steps[i];
+        if (step.op == CNNStep::RELU && nonNegative)
+        {
+            steps.erase(steps.begin() + i);
+            continue;
+        }
+        if (step.op == CNNStep::RELU)
+            nonNegative = true;
+        else if (step.op == CNNStep::SOFTMAX)
+            nonNegative = (step.head != CNNHead::LOGIT);
+        else if (step.op != CNNStep::MAXPOOL)
+            nonNegative = false;
+        i++;
+    }
+}
+
+// Whether the engines AUTO can pick for the step apply a following RELU
+// themselves. Without a direct kernel small maps still go to GEMM, which
+// does not; the order is then only less than ideal.
+static bool absorbsRelu(const CNNStep &step)
+{
+    if (step.op != CNNStep::CONV && step.op != CNNStep::FC)
+        return false;
+    if (step.algorithm == CNNConvAlgo::GEMM || step.algorithm == CNNConvAlgo::DIRECT)
+        return false;
+    return step.direct != nullptr || step.winograd || step.int8;
+}
+
+void Graph::placeRelu(vector<CNNStep> &steps)
+{
+    for (size_t i = 0; i + 2 < steps.size(); i++)
+    {
+        if (steps[i].op != CNNStep::CONV && steps[i].op != CNNStep::FC)
+            continue;
+        const int first  = steps[i + 1].op;
+        const int second = steps[i + 2].op;
+        const bool absorbs = absorbsRelu(steps[i]);
+        if ((absorbs && first == CNNStep::MAXPOOL && second == CNNStep::RELU) ||
+            (!absorbs && first == CNNStep::RELU && second == CNNStep::MAXPOOL))
+            std::swap(steps[i + 1], steps[i + 2]);
+    }
+}
+
+// Floats of a weight plane, whatever it is stored as.
+static Mat widened(const Mat &weights, int format)
+{
+    if (weights.depth() == CV_32F)
+        return weights;
+    Mat _weights(weights.rows, weights.cols, CV_32F);
+    for (int r = 0; r < weights.rows; r++)
+        Half::widen(weights.ptr<uint16_t>(r), weights.cols, format, _weights.ptr<float>(r));
+    return _weights;
+}
+
+void Graph::foldHead(vector<CNNStep> &steps, const vector<CNNLayer> &layers)
+{
+    for (size_t i = 0; i + 1 < steps.size(); i++)
+    {
+        const CNNStep &step = steps[i];
+        const CNNStep &head = steps[i + 1];
+        if ((step.op != CNNStep::CONV && step.op != CNNStep::FC) || step.nLayers != 2 ||
+            head.op != CNNStep::SOFTMAX || head.head == CNNHead::SOFTMAX)
+            continue;
+
+        const CNNLayer &layer = step.derived ? *step.derived : layers[step.layer];
+        const int kernelD     = step.kernelD;
+        shared_ptr<CNNLayer> folded = make_shared<CNNLayer>();
+        folded->type   = layer.type;
+        folded->params = layer.params;
+        folded->params[CNNStringParam::NLayers] = 1;
+        folded->bias.assign(1, layer.bias[0] - layer.bias[1]);
+        folded->weights.resize(kernelD);
+        for (int d = 0; d < kernelD; d++)
+        {
+            const Mat w0 = widened(layer.weights[d], step.weightFormat);
+            const Mat w1 = widened(layer.weights[kernelD + d], step.weightFormat);
+            Mat &w = folded->weights[d];
+            w.create(w0.rows, w0.cols, CV_32F);
+            for (int r = 0; r < w.rows; r++)
+                for (int c = 0; c < w.cols; c++)
+                    w.at<float>(r, c) = w0.at<float>(r, c) - w1.at<float>(r, c);
+        }
+        folded->prepare();
+
+        const bool logit = (head.head == CNNHead::LOGIT);
+        CNNStep _step = lower(*folded, step.layer);
+        _step.derived = folded;
+        steps[i] = _step;
+        if (logit)
+            steps.erase(steps.begin() + i + 1);
+    }
+}
+
+void Graph::fuse(vector<CNNStep> &steps)
+{
+    // A CONV or FC run by the direct, Winograd, GEMV or int8 kernels absorbs
+    // the RELU right after it. A CONV with a pooled kernel absorbs the RELU
+    // and MAXPOOL after it in either order, since ReLU and max commute.
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        CNNStep &step = steps[i];
+        if (step.op != CNNStep::CONV && step.op != CNNStep::FC)
+            continue;
+        step.reluNext = (i + 1 < steps.size() && steps[i + 1].op == CNNStep::RELU);
+        if (step.pooled == nullptr)
+            continue;
+
+        const CNNStep *pool = nullptr;
+        bool relu = false;
+        size_t j  = i + 1;
+        for (; j < steps.size(); j++)
+        {
+            if (steps[j].op == CNNStep::RELU && !relu)
+                relu = true;
+            else if (steps[j].op == CNNStep::MAXPOOL && pool == nullptr)
+                pool = &steps[j];
+            else
+                break;
+        }
+        if (pool != nullptr)
+        {
+            step.pooledSpan = static_cast<int>(j - i - 1);
+            step.pooledRelu = relu;
+            step.window     = pool->window;
+        }
+    }
+}
+
+double Graph::flops(const vector<CNNStep> &steps, int channels, int rows, int cols,
+                    vector<double> *perStep)
+{
+    // A RELU applied by the kernel of the step before it costs no pass and
+    // is not counted.
+    double total = 0.;
+    int fused    = 0;
+    if (perStep)
+        perStep->clear();
+
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        const CNNStep &step = steps[i];
+        const double pixels = static_cast<double>(rows) * cols;
+        double f = 0.;
+        if (step.op == CNNStep::CONV || step.op == CNNStep::FC)
+        {
+            cols     = (cols + 2 * step.padW - step.kernelW) / step.strideW + 1;
+            rows     = (rows + 2 * step.padH - step.kernelH) / step.strideH + 1;
+            channels = step.nLayers;
+            f = 2. * step.kernelD * step.kernelW * step.kernelH * channels * rows * cols;
+            if (step.pooledSpan > 0 && step.pooledRelu)
+                fused = step.pooledSpan;
+            else if (step.reluNext && absorbsRelu(step))
+                fused = 1;
+        }
+        else if (step.op == CNNStep::RELU)
+            f = (fused > 0) ? 0. : channels * pixels;
+        else if (step.op == CNNStep::MAXPOOL)
+        {
+            cols = MaxPool::outputSize(cols, step.window.width, step.window.strideW, step.window.padW);
+            rows = MaxPool::outputSize(rows, step.window.height, step.window.strideH, step.window.padH);
+            f = (step.window.width * step.window.height - 1.) * channels * rows * cols;
+        }
+        else if (step.op == CNNStep::SOFTMAX && channels <= 2 && step.head != CNNHead::SOFTMAX)
+        {
+            // l0 - l1, then 1 / (1 + exp(-d)) for SIGMOID.
+            f = ((channels == 2) ? 1. : 0.) + ((step.head == CNNHead::SIGMOID) ? 3. : 0.);
+            f *= pixels;
+            channels = 1;
+        }
+        else if (step.op == CNNStep::SOFTMAX)
+            f = 4. * channels * pixels;     // max, subtract, exp, divide
+
+        if (step.op != CNNStep::CONV && step.op != CNNStep::FC && fused > 0)
+            fused--;
+        total += f;
+        if (perStep)
+            perStep->push_back(f);
+    }
+    return total;
+}
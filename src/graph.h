@@ -0,0 +1,79 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __graph__
+#define __graph__
+
+#include "cnn.h"
+
+namespace cnn
+{
+    // Lowering of the layers of a CNN to its steps, and passes that rewrite
+    // the steps into an equivalent, cheaper sequence. The layers themselves
+    // are left alone, so a CNN still writes the model it read.
+    class Graph
+    {
+    public:
+        // The step of a layer; index is its place in the CNN's layers.
+        static CNNStep lower(const CNNLayer &layer, size_t index);
+
+        // eliminateRelu, placeRelu and foldHead, in that order.
+        static void optimize(vector<CNNStep> &steps, const vector<CNNLayer> &layers);
+
+        // Drops every RELU whose input is already non-negative: the output of
+        // a RELU or SOFTMAX, through any number of MAXPOOLs.
+        static void eliminateRelu(vector<CNNStep> &steps);
+
+        // ReLU and max pooling commute. A CONV/FC followed by both gets the
+        // RELU first when it can absorb it, and the MAXPOOL first otherwise
+        // so that the RELU runs on the smaller map.
+        static void placeRelu(vector<CNNStep> &steps);
+
+        // A two-class SIGMOID or LOGIT head only needs l0 - l1: the FC before
+        // it becomes a one-output FC with the difference of the two rows of
+        // weights and biases, and a LOGIT head is dropped.
+        static void foldHead(vector<CNNStep> &steps, const vector<CNNLayer> &layers);
+
+        // Decides which of the following steps each CONV/FC absorbs.
+        static void fuse(vector<CNNStep> &steps);
+
+        // Floating point operations of a pass over an input of the given
+        // shape, and of every step in perStep. A RELU absorbed by the step
+        // before it counts as free.
+        static double flops(const vector<CNNStep> &steps, int channels, int rows, int cols,
+                            vector<double> *perStep = nullptr);
+    };
+}
+
+#endif
@@ -0,0 +1,95 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include "half.h"
+#include "simd.h"
+
+using namespace cnn;
+
+uint16_t Half::narrow(float value, int format)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (format == BF16)
+    {
+        if ((bits & 0x7fffffff) > 0x7f800000)
+            return static_cast<uint16_t>((bits >> 16) | 0x40);
+        return static_cast<uint16_t>((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+    }
+
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    const uint32_t abs  = bits & 0x7fffffff;
+    if (abs > 0x7f800000)
+        return sign | 0x7e00;
+    if (abs >= 0x477ff000)      // rounds past the largest half
+        return sign | 0x7c00;
+    if (abs < 0x38800000)       // subnormal or zero half
+    {
+        if (abs < 0x33000000)
+            return sign;
+        const int      shift    = 126 - static_cast<int>(abs >> 23);
+        const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        uint32_t       half     = mantissa >> shift;
+        const uint32_t rest     = mantissa & ((1u << shift) - 1);
+        const uint32_t middle   = 1u << (shift - 1);
+        if (rest > middle || (rest == middle && (half & 1)))
+            half++;
+        return sign | static_cast<uint16_t>(half);
+    }
+    const uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1) - (112u << 23);
+    return sign | static_cast<uint16_t>(rounded >> 13);
+}
+
+void Half::narrow(const float *src, size_t n, int format, uint16_t *dst)
+{
+    size_t i = 0;
+#if defined(CNN_SIMD_AVX2) && defined(__F16C__)
+    if (format == FP16)
+        for (; i + 8 <= n; i += 8)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                             _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < n; i++)
+        dst[i] = narrow(src[i], format);
+}
+
+void Half::widen(const uint16_t *src, size_t n, int format, float *dst)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        simd::store(dst + i, (format == BF16) ? simd::loadBf16(src + i) : simd::loadFp16(src + i));
+    for (; i < n; i++)
+        dst[i] = widen(src[i], format);
+}
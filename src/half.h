@@ -0,0 +1,97 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __half__
+#define __half__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace cnn
+{
+    // 16-bit storage of float weights: IEEE half precision (fp16), or the
+    // upper half of a float (bf16, same range as float with 8 bits of
+    // mantissa). Narrowing rounds to nearest even.
+    class Half
+    {
+    public:
+        enum
+        {
+            FP32 = 0,
+            FP16 = 1,
+            BF16 = 2
+        };
+
+        static uint16_t narrow(float value, int format);
+
+        static inline float widen(uint16_t value, int format)
+        {
+            uint32_t bits;
+            if (format == BF16)
+                bits = static_cast<uint32_t>(value) << 16;
+            else
+            {
+                const uint32_t sign     = static_cast<uint32_t>(value & 0x8000) << 16;
+                uint32_t       exponent = (value >> 10) & 0x1f;
+                uint32_t       mantissa = value & 0x3ff;
+                if (exponent == 0x1f)
+                    bits = sign | 0x7f800000 | (mantissa << 13);
+                else if (exponent != 0)
+                    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+                else if (mantissa == 0)
+                    bits = sign;
+                else
+                {
+                    // Subnormal: normalize.
+                    exponent = 113;
+                    while ((mantissa & 0x400) == 0)
+                    {
+                        mantissa <<= 1;
+                        exponent--;
+                    }
+                    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+                }
+            }
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+
+        static void narrow(const float *src, size_t n, int format, uint16_t *dst);
+        static void widen(const uint16_t *src, size_t n, int format, float *dst);
+    };
+}
+
+#endif
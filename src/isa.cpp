@@ -0,0 +1,257 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "isa.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CNN_ISA_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+using namespace cnn;
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        const Kernels &kernels()
+        {
+            static const Kernels table = []()
+            {
+                Kernels kernels;
+                bindDirect(kernels);
+                bindGemm(kernels);
+                bindWinograd(kernels);
+                bindQuant(kernels);
+                bindPool(kernels);
+                bindResample(kernels);
+                bindActivation(kernels);
+                return kernels;
+            }();
+            return table;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+namespace
+{
+#if defined(CNN_ISA_X86) && defined(_MSC_VER)
+    void cpuid(int leaf, int sub, unsigned r[4])
+    {
+        int regs[4];
+        __cpuidex(regs, leaf, sub);
+        for (int i = 0; i < 4; i++)
+            r[i] = static_cast<unsigned>(regs[i]);
+    }
+
+    unsigned long long xgetbv()
+    {
+        return _xgetbv(0);
+    }
+#elif defined(CNN_ISA_X86)
+    void cpuid(int leaf, int sub, unsigned r[4])
+    {
+        __cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+    }
+
+    unsigned long long xgetbv()
+    {
+        unsigned lo, hi;
+        __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (static_cast<unsigned long long>(hi) << 32) | lo;
+    }
+#endif
+
+    bool bit(unsigned value, int b)
+    {
+        return (value >> b) & 1;
+    }
+
+    struct Features
+    {
+        bool avx2;          // AVX, FMA, F16C and AVX2, with the ymm state
+        bool avx512;        // AVX-512 F, DQ, BW and VL, with the zmm state
+        bool avxVnni;
+        bool avx512Vnni;
+    };
+
+    Features features()
+    {
+        Features f = { false, false, false, false };
+#ifdef CNN_ISA_X86
+        unsigned r[4];
+        cpuid(0, 0, r);
+        if (r[0] < 7)
+            return f;
+        cpuid(1, 0, r);
+        const unsigned leaf1 = r[2];
+        cpuid(7, 0, r);
+        const unsigned leaf7 = r[1], leaf7c = r[2];
+        cpuid(7, 1, r);
+        const unsigned leaf71 = r[0];
+
+        // The OS saving the ymm state; for AVX-512 the opmask and zmm state
+        // as well.
+        const unsigned long long xcr0 = bit(leaf1, 27) ? xgetbv() : 0;
+        f.avx2       = (xcr0 & 0x06) == 0x06 && bit(leaf1, 28) && bit(leaf1, 12) &&
+                       bit(leaf1, 29) && bit(leaf7, 5);
+        f.avx512     = f.avx2 && (xcr0 & 0xe6) == 0xe6 && bit(leaf7, 16) && bit(leaf7, 17) &&
+                       bit(leaf7, 30) && bit(leaf7, 31);
+        f.avxVnni    = f.avx2 && bit(leaf71, 4);
+        f.avx512Vnni = f.avx512 && bit(leaf7c, 11);
+#endif
+        return f;
+    }
+
+    int select()
+    {
+        const int detected = Isa::detect();
+        const char *forced = std::getenv("CASCADE_ISA");
+        if (forced == nullptr || *forced == '\0')
+            return detected;
+        for (int level = Isa::BASELINE; level <= Isa::AVX512; level++)
+            if (std::strcmp(forced, Isa::name(level)) == 0)
+                return std::min(level, detected);
+        CV_Error(Error::StsBadArg, string("CASCADE_ISA must be baseline, avx2 or avx512, not ") + forced);
+        return detected;
+    }
+
+    int selectVnni()
+    {
+        const Features f = features();
+#ifdef CNN_HAVE_AVX512VNNI
+        // Built with AVX-512, the GEMM keeps more accumulators in ymm16-31.
+        if (Isa::level() >= Isa::AVX512 && f.avx512Vnni)
+            return Isa::AVX512_VNNI;
+#endif
+#ifdef CNN_HAVE_AVXVNNI
+        if (Isa::level() >= Isa::AVX2 && f.avxVnni)
+            return Isa::AVX_VNNI;
+#endif
+        (void)f;
+        return Isa::NO_VNNI;
+    }
+}
+
+int Isa::detect()
+{
+    const Features f = features();
+    int level = BASELINE;
+#ifdef CNN_HAVE_AVX2
+    if (f.avx2)
+        level = AVX2;
+#endif
+#ifdef CNN_HAVE_AVX512
+    if (f.avx512)
+        level = AVX512;
+#endif
+    (void)f;
+    return level;
+}
+
+int Isa::level()
+{
+    static const int level = select();
+    return level;
+}
+
+const char *Isa::name(int level)
+{
+    switch (level)
+    {
+        case AVX2:   return "avx2";
+        case AVX512: return "avx512";
+        default:     return "baseline";
+    }
+}
+
+int Isa::vnni()
+{
+    static const int vnni = selectVnni();
+    return vnni;
+}
+
+const char *Isa::vnniName(int vnni)
+{
+    switch (vnni)
+    {
+        case AVX_VNNI:    return "avxvnni";
+        case AVX512_VNNI: return "avx512vnni";
+        default:          return "none";
+    }
+}
+
+const Kernels &Isa::kernels()
+{
+    static const Kernels table = []()
+    {
+        Kernels kernels;
+        switch (level())
+        {
+#ifdef CNN_HAVE_AVX512
+            case AVX512: kernels = avx512::kernels(); break;
+#endif
+#ifdef CNN_HAVE_AVX2
+            case AVX2:   kernels = avx2::kernels(); break;
+#endif
+            default:     kernels = baseline::kernels(); break;
+        }
+
+        Kernels vnniKernels = kernels;
+        switch (vnni())
+        {
+#ifdef CNN_HAVE_AVXVNNI
+            case AVX_VNNI:    avxvnni::bindQuant(vnniKernels); break;
+#endif
+#ifdef CNN_HAVE_AVX512VNNI
+            case AVX512_VNNI: avx512vnni::bindQuant(vnniKernels); break;
+#endif
+            default:          break;
+        }
+        kernels.qgemm = vnniKernels.qgemm;
+        return kernels;
+    }();
+    return table;
+}
+
+#endif
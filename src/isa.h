@@ -0,0 +1,166 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __isa__
+#define __isa__
+
+#include "tensor.h"
+#include "direct.h"
+#include "pool.h"
+#include "quant.h"
+#include "resample.h"
+
+// The kernel sources are built once per ISA level (see CMakeLists.txt), with
+// CNN_ISA naming the namespace of the level. Only the baseline build, which
+// leaves it unset, defines the class methods; in it they forward to the
+// kernels of the level picked at startup.
+#ifndef CNN_ISA
+#define CNN_ISA baseline
+#define CNN_ISA_BASELINE
+#endif
+
+namespace cnn
+{
+    // Entry points of the hot kernels as built for one ISA level. They have
+    // the signatures of the class methods they implement.
+    struct Kernels
+    {
+        // Direct
+        Direct::Kernel       (*direct)(int kernelW, int kernelH, int strideW, int strideH, int format);
+        Direct::PooledKernel (*pooled)(int kernelW, int kernelH, int strideW, int strideH, int format);
+
+        // Gemm
+        void (*packB)(int kc, int nc, const float *B, int ldb, float *packedB);
+        void (*macroKernel)(int M, int nc, int kc, const float *packedA, const float *packedB,
+                            float *C, int ldc, bool accumulate);
+        void (*sgemm)(int M, int N, int K, const float *packedA, const float *B, int ldb,
+                      float *C, int ldc, bool accumulate);
+        void (*sgemv)(int M, int K, const float *A, size_t lda, const float *x, float *y);
+        void (*hgemv)(int M, int K, const uint16_t *A, size_t lda, int format,
+                      const float *x, float *y);
+
+        // Winograd
+        void (*transformInput)(int m, const float *d, size_t ds, float *v, size_t stride);
+        void (*transformOutput)(int m, const float *mm, size_t stride, float *y);
+
+        // Quant
+        void (*quantize)(const float *x, size_t n, const Quant::Activation &a, uint8_t *q);
+        void (*dequantize)(const int32_t *acc, int n, const float *scales,
+                           const float *offsets, bool relu, float *out);
+        void (*qgemm)(int nLayers, int N, int K, const uint8_t *cols,
+                      const int8_t *packed, int32_t *acc, size_t accRow);
+
+        // MaxPool
+        void (*horizontal)(const float *in, int cols, int lanes, const MaxPool::Window &window,
+                           float *out, int outputW);
+        void (*vertical)(const float *const *rows, int n, float *out, size_t count, bool relu);
+        void (*pool)(const float *in, size_t inputRow, int rows, int cols, int lanes,
+                     const MaxPool::Window &window, float *out, size_t outputRow,
+                     int outputW, int outputH, bool relu, Arena &scratch);
+
+        // Resample
+        void (*areaRow8)(const uint8_t *in, const Resample::Taps &taps, int outputW, float *out);
+        void (*areaRow)(const float *in, const Resample::Taps &taps, int outputW, float *out);
+        void (*areaRows)(const float *const *rows, const float *weights, int n,
+                         float *out, size_t count, float mean, float scale);
+        void (*moments)(const uint8_t *in, size_t inputRow, int rows, int cols,
+                        uint64_t &sum, uint64_t &squares);
+
+        // Op
+        void (*relu)(const Tensor &input, Tensor &output);
+        void (*softmax)(const Tensor &input, Tensor &output, int head);
+    };
+
+    // Runtime ISA dispatch. One binary carries the kernels built for every
+    // level and runs those of the highest level the CPU supports, decided
+    // once at the first call from cpuid. The CASCADE_ISA environment
+    // variable (baseline, avx2 or avx512) forces a lower level, e.g. to
+    // benchmark the fallbacks on a newer machine.
+    class Isa
+    {
+    public:
+        enum Level
+        {
+            BASELINE = 0,   // SSE4.2 in dispatching x86 builds
+            AVX2     = 1,   // AVX2, FMA and F16C
+            AVX512   = 2    // AVX-512 F/VL/BW/DQ on top of AVX2
+        };
+
+        // Int8 dot products in the kernels: those of level(), or vpdpbusd.
+        enum Vnni
+        {
+            NO_VNNI     = 0,
+            AVX_VNNI    = 1,    // AVX-VNNI, from the AVX2 level up
+            AVX512_VNNI = 2     // AVX512-VNNI, at the AVX512 level
+        };
+
+        // Highest level built into the binary that the CPU and OS support.
+        static int detect();
+        // Level the kernels run at: detect(), or CASCADE_ISA capped at it.
+        static int level();
+        static const char *name(int level);
+
+        // The VNNI build of Quant::gemm that replaces level()'s, if the
+        // binary has one the CPU supports.
+        static int vnni();
+        static const char *vnniName(int vnni);
+
+        static const Kernels &kernels();
+    };
+
+    // Kernels of every level; avx2 and avx512 exist when CNN_HAVE_AVX2 and
+    // CNN_HAVE_AVX512 are defined.
+    namespace baseline { const Kernels &kernels(); }
+    namespace avx2     { const Kernels &kernels(); }
+    namespace avx512   { const Kernels &kernels(); }
+
+    // Quant built again with AVX-VNNI and AVX512-VNNI, when CNN_HAVE_AVXVNNI
+    // and CNN_HAVE_AVX512VNNI are defined; only its qgemm is used.
+    namespace avxvnni    { void bindQuant(Kernels &kernels); }
+    namespace avx512vnni { void bindQuant(Kernels &kernels); }
+
+    // Fill the entries each kernel source implements at the current level.
+    namespace CNN_ISA
+    {
+        void bindDirect(Kernels &kernels);
+        void bindGemm(Kernels &kernels);
+        void bindWinograd(Kernels &kernels);
+        void bindQuant(Kernels &kernels);
+        void bindPool(Kernels &kernels);
+        void bindResample(Kernels &kernels);
+        void bindActivation(Kernels &kernels);
+    }
+}
+
+#endif
@@ -5,13 +5,18 @@
 #include <iostream>
 #include <ctime>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstring>
 
 using namespace cv;
 using namespace std;
 
 #include "storage.h"
+#include "fixed.h"
+#include "isa.h"
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
         // Read the model .bin files  to .xml
        // cnn::createCNNs();
@@ -24,6 +29,7 @@ int main(int, char**)
 			"../../../weights/model_48net.bin.xml",
 			"../../../weights/model_48cnet.bin.xml",
 		};
+        string tuningFilename = "../../../weights/tuning.xml";
         #endif
 
         #ifdef OnLinux
@@ -33,34 +39,209 @@ int main(int, char**)
 			"../../weights/model_48net.bin.xml",
 			"../../weights/model_48cnet.bin.xml",
 		};
+        string tuningFilename = "../../weights/tuning.xml";
         #endif
 
+        // Int8 nets calibrated offline by --int8 <directory> are saved next
+        // to the float ones; --int8 alone detects with them.
+        vector<string> int8Files;
+        for (size_t i = 0; i < files.size(); i++)
+            int8Files.push_back(files[i].substr(0, files[i].rfind(".bin.xml")) + ".int8.bin.xml");
+        const bool int8 = (argc == 2 && string(argv[1]) == "--int8");
+        const vector<string> &weights = int8 ? int8Files : files;
+
 		cnn::CNN net20("20net");
 		cnn::CNN net12c("12cnet");
 		cnn::CNN net48("48net");
 		cnn::CNN net48c("48cnet");
-		loadNet(files[0], net20);
-		loadNet(files[1], net12c);
-		loadNet(files[2], net48);
-		loadNet(files[3], net48c);
+		loadNet(weights[0], net20);
+		loadNet(weights[1], net12c);
+		loadNet(weights[2], net48);
+		loadNet(weights[3], net48c);
+		net20.setHead(cnn::CNNHead::SIGMOID);
+		net48.setHead(cnn::CNNHead::SIGMOID);
+		cout << "kernels: " << cnn::Isa::name(cnn::Isa::level())
+		     << ", int8 vnni: " << cnn::Isa::vnniName(cnn::Isa::vnni()) << endl;
+
+        // Engines measured by --tune, when there is a tuning file.
+        shared_ptr<cnn::Tuning> tuning = make_shared<cnn::Tuning>();
+        if (cnn::loadTuning(tuningFilename, *tuning))
+        {
+            net20.setTuning(tuning);
+            net12c.setTuning(tuning);
+            net48.setTuning(tuning);
+            net48c.setTuning(tuning);
+            cout << "tuning: " << tuning->size() << " entries" << endl;
+        }
+
+        // --flops: FLOPs of one window of every net before and after the
+        // graph passes.
+        if (argc > 1 && string(argv[1]) == "--flops")
+        {
+            net20.printFlops(Size(20, 20), 1, cout);
+            net12c.printFlops(net12c.field(), 1, cout);
+            net48.printFlops(Size(48, 48), 1, cout);
+            net48c.printFlops(Size(48, 48), 1, cout);
+            return 0;
+        }
+
+        // --fixed: run the second stage on the compile-time FixedCNN48 nets.
+        const bool fixed = (argc > 1 && string(argv[1]) == "--fixed");
+        cnn::FixedCNN48 fixed48;
+        cnn::FixedCNN48Calibration fixed48c;
+        if (fixed)
+        {
+            fixed48.load(net48);
+            fixed48c.load(net48c);
+        }
+
+        // --int8 <directory>: calibrate int8 nets on the images of the
+        // directory, report their drift from float, save them to int8Files
+        // and detect with them.
+        if (argc > 2 && string(argv[1]) == "--int8")
+        {
+            struct Stage { cnn::CNN *net; string name; Size size; };
+            vector<Stage> stages = {
+                { &net20,  "20net",  Size(160, 120) },
+                { &net12c, "12cnet", net12c.field() },
+                { &net48,  "48net",  Size(48, 48)   },
+                { &net48c, "48cnet", Size(48, 48)   },
+            };
+            for (size_t s = 0; s < stages.size(); s++)
+            {
+                vector<Mat> samples;
+                cnn::Alg::loadSamples(argv[2], stages[s].size, samples);
+                cnn::CNN reference = *stages[s].net;
+                stages[s].net->quantize(samples);
+                cnn::Alg::quantizationDrift(stages[s].name, reference, *stages[s].net, samples, .5f, cout);
+                saveNet(int8Files[s], *stages[s].net);
+            }
+        }
 
         // Load image for face detection
         // string imageFilename = "../../../test/img/group1.jpg";
         string imageFilename = "../../test/img/group1.jpg";
         Mat display = imread(imageFilename);
-        Mat image = imread(imageFilename, IMREAD_GRAYSCALE), imageN, resized;
+        Mat gray = imread(imageFilename, IMREAD_GRAYSCALE), image;
+
+        // The pyramid levels come normalized straight from the 8-bit image
+        // (Alg::buildPyramid); the second stage crops the [0, 1] one.
+        gray.convertTo(image, CV_32F, 1. / 255.);
+
+        // --stress [threads] [iterations]: threads threads, each with its own
+        // Workspace, run 20net over the image and 12cnet, 48net, 48cnet and
+        // FixedCNN48 over random crops of it on the shared nets, and compare
+        // every output bit for bit with a single-threaded pass. Build with
+        // -fsanitize=thread to check the concurrency contract of CNN too.
+        if (argc > 1 && string(argv[1]) == "--stress")
+        {
+            const int threads    = (argc > 2) ? atoi(argv[2]) : 16;
+            const int iterations = (argc > 3) ? atoi(argv[3]) : 10;
+
+            RNG rng(0x5eed);
+            vector<Mat> crops12, crops48;
+            for (int i = 0; i < 32; i++)
+            {
+                const int side = min(rng.uniform(30, 180), min(image.cols, image.rows));
+                const Rect face(rng.uniform(0, image.cols - side + 1), rng.uniform(0, image.rows - side + 1),
+                                side, side);
+                Mat crop;
+                resize(image(face), crop, net12c.field(), 0, 0, INTER_AREA);
+                crops12.push_back(crop);
+                resize(image(face), crop, Size(48, 48), 0, 0, INTER_AREA);
+                crops48.push_back(crop);
+            }
+            cnn::FixedCNN48 stress48;
+            stress48.load(net48);
+
+            auto pass = [&](cnn::Workspace &workspace, vector<vector<Mat> > &outputs)
+            {
+                outputs.assign(1 + 4 * crops48.size(), vector<Mat>());
+                net20.forward(image, outputs[0], workspace);
+                for (size_t i = 0; i < crops48.size(); i++)
+                {
+                    net12c.forward(crops12[i], outputs[1 + 4 * i], workspace);
+                    net48.forward(crops48[i], outputs[2 + 4 * i], workspace);
+                    net48c.forward(crops48[i], outputs[3 + 4 * i], workspace);
+                    stress48.forward(crops48[i], outputs[4 + 4 * i], workspace);
+                }
+            };
+            auto identical = [](const Mat &a, const Mat &b)
+            {
+                if (a.size() != b.size() || a.type() != b.type())
+                    return false;
+                for (int y = 0; y < a.rows; y++)
+                    if (memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize()) != 0)
+                        return false;
+                return true;
+            };
 
-        image.convertTo(image, CV_32F);
-        image = image / 255.f;
+            cnn::Workspace workspace;
+            vector<vector<Mat> > reference;
+            pass(workspace, reference);
 
-        cnn::Op::normGlobal(image, imageN);
+            atomic<int> mismatches(0);
+            vector<thread> workers;
+            for (int t = 0; t < threads; t++)
+                workers.push_back(thread([&]()
+                {
+                    cnn::Workspace own;
+                    vector<vector<Mat> > outputs;
+                    for (int i = 0; i < iterations; i++)
+                    {
+                        pass(own, outputs);
+                        for (size_t k = 0; k < outputs.size(); k++)
+                        {
+                            if (outputs[k].size() != reference[k].size())
+                                mismatches++;
+                            else
+                                for (size_t c = 0; c < outputs[k].size(); c++)
+                                    if (!identical(outputs[k][c], reference[k][c]))
+                                        mismatches++;
+                        }
+                    }
+                }));
+            for (size_t t = 0; t < workers.size(); t++)
+                workers[t].join();
+
+            cout << "stress: " << threads << " threads x " << iterations << " passes, "
+                 << mismatches << " mismatching outputs" << endl;
+            return mismatches == 0 ? 0 : 1;
+        }
 
         double winSize = 20.;
         double minFaceSize = 30.;
         double maxFaceSize = 180.;
         double pyramidRate = sqrt(2.0);
-        double faceSize = minFaceSize;
-        double factor;
+        cnn::PyramidParam pyramid = { winSize, minFaceSize, maxFaceSize, pyramidRate, .75f, 4.f, 0.4f, .9f };
+        vector<double> factors;
+        vector<Mat> levels;
+
+        // --tune [file]: benchmark the engines of every net at the shapes
+        // this image runs them on, single and multi-threaded, and save the
+        // winners to the tuning file.
+        if (argc > 1 && string(argv[1]) == "--tune")
+        {
+            if (argc > 2)
+                tuningFilename = argv[2];
+            vector<int> threads = { 1 };
+            if (thread::hardware_concurrency() > 1)
+                threads.push_back(thread::hardware_concurrency());
+
+            cnn::Tuning tuned;
+            cnn::Alg::buildPyramid(gray, pyramid, factors, levels);
+            for (size_t t = 0; t < threads.size(); t++)
+            {
+                for (size_t level = 0; level < levels.size(); level++)
+                    net20.tune(levels[level].size(), 1, threads[t], tuned);
+                net12c.tune(net12c.field(), 1, threads[t], tuned);
+                net48.tune(Size(48, 48), 1, threads[t], tuned);
+                net48c.tune(Size(48, 48), 1, threads[t], tuned);
+            }
+            cnn::saveTuning(tuningFilename, tuned);
+            cout << "tuning: " << tuned.size() << " entries saved to " << tuningFilename << endl;
+            return 0;
+        }
 
 		// first layer
         cnn::CNNParam params;
@@ -73,18 +254,31 @@ int main(int, char**)
         std::chrono::time_point<std::chrono::system_clock> start, end;
         start = std::chrono::system_clock::now();
     
+        // The pyramid levels run in parallel unless --sequential, which
+        // also shows the detections of every level, or --canvas, which
+        // packs them into one image for a single 20net pass.
+        const bool sequential = (argc > 1 && string(argv[1]) == "--sequential");
+        const bool canvas = (argc > 1 && string(argv[1]) == "--canvas");
+        if (canvas)
+            cnn::Alg::detectCanvas(gray, net20, net12c, params, pyramid, outputs12,
+                                   max(1u, thread::hardware_concurrency()));
+        else if (!sequential)
+            cnn::Alg::detectPyramid(gray, net20, net12c, params, pyramid, outputs12,
+                                    max(1u, thread::hardware_concurrency()));
+        else
+            cnn::Alg::buildPyramid(gray, pyramid, factors, levels);
     
-        while (faceSize < min(image.rows, image.cols) && faceSize < maxFaceSize)
+        for (size_t level = 0; sequential && level < levels.size(); level++)
         {
-            factor = winSize/faceSize;
-            resize(imageN, resized, Size(0,0), factor, factor, INTER_AREA);
+            const double factor = factors[level];
+            Mat &resized = levels[level];
             Mat score;
 
 			cnn::Alg::detect(resized, net20, params, outputs, score, .75f, 4.f);
 			cnn::Alg::calibrate(resized, net12c, outputs, 0.4f);
             cnn::Alg::nms(outputs, .9f);
 			cnn::Alg::backProject(outputs, factor);
-			cnn::Alg::displayResults(display, outputs, "Face Size "+ to_string((int)faceSize));
+			cnn::Alg::displayResults(display, outputs, "Face Size "+ to_string((int)(winSize / factor)));
 			outputs12.insert(outputs12.end(), outputs.begin(), outputs.end());
 
 //            cnn::Alg::detect(resized, net20, params, outputs, score, .5f, 4.f);
@@ -97,7 +291,6 @@ int main(int, char**)
 //            imshow("heatmap", heatmap);
 //            waitKey();
 
-            faceSize *= pyramidRate;
             outputs.clear();
         }
 
@@ -105,7 +298,10 @@ int main(int, char**)
 
 		params.KernelH = 48;
 		params.KernelW = 48;
-		cnn::Alg::forwardDetection(image, outputs12, net48, net48c, params, outputs48, .5f, .8f, true);
+		if (fixed)
+			cnn::Alg::forwardDetection(image, outputs12, fixed48, fixed48c, params, outputs48, .5f, .8f, true);
+		else
+			cnn::Alg::forwardDetection(image, outputs12, net48, net48c, params, outputs48, .5f, .8f, true);
 		cnn::Alg::nms(outputs48, .2f);
 		cnn::Alg::displayResults(display, outputs48, "results");
 
@@ -0,0 +1,241 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "parallel.h"
+
+using namespace cnn;
+using namespace std;
+
+namespace
+{
+    // One call of run, on the caller's stack. Parts are claimed under the
+    // lock, so a worker only touches a job while it is queued or while it
+    // runs one of its parts, and the caller returns after both are over.
+    struct Job
+    {
+        Parallel::Task task;
+        const void    *body;
+        int            parts;
+        int            next;
+        int            done;
+    };
+
+    class Workers
+    {
+    public:
+        static Workers& instance()
+        {
+            static Workers workers;
+            return workers;
+        }
+
+        int size() const { return static_cast<int>(_threads.size()); }
+
+        void run(Job &job, Arena &scratch)
+        {
+            {
+                lock_guard<mutex> lock(_lock);
+                _queue.push_back(&job);
+            }
+            for (int i = 1; i < job.parts && i <= size(); i++)
+                _wake.notify_one();
+
+            for (int part; (part = claim(job)) < job.parts; )
+            {
+                job.task(job.body, part, scratch);
+                finish(job);
+            }
+
+            unique_lock<mutex> lock(_lock);
+            _finished.wait(lock, [&job]() { return job.done == job.parts; });
+            deque<Job*>::iterator it = std::find(_queue.begin(), _queue.end(), &job);
+            if (it != _queue.end())
+                _queue.erase(it);
+        }
+
+    private:
+        Workers(): _stop(false)
+        {
+            const int n = static_cast<int>(std::max(thread::hardware_concurrency(), 1u)) - 1;
+            for (int i = 0; i < n; i++)
+                _threads.emplace_back(&Workers::work, this);
+        }
+
+        ~Workers()
+        {
+            {
+                lock_guard<mutex> lock(_lock);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (size_t i = 0; i < _threads.size(); i++)
+                _threads[i].join();
+        }
+
+        int claim(Job &job)
+        {
+            lock_guard<mutex> lock(_lock);
+            return job.next++;
+        }
+
+        void finish(Job &job)
+        {
+            lock_guard<mutex> lock(_lock);
+            if (++job.done == job.parts)
+                _finished.notify_all();
+        }
+
+        // Runs parts of the front job; a job whose parts are all claimed
+        // leaves the queue.
+        void work()
+        {
+            Arena arena;
+            for (;;)
+            {
+                Job *job;
+                int part;
+                {
+                    unique_lock<mutex> lock(_lock);
+                    _wake.wait(lock, [this]() { return _stop || !_queue.empty(); });
+                    if (_stop)
+                        return;
+                    job  = _queue.front();
+                    part = job->next++;
+                    if (part >= job->parts)
+                    {
+                        _queue.pop_front();
+                        continue;
+                    }
+                }
+                arena.reset();
+                job->task(job->body, part, arena);
+                finish(*job);
+            }
+        }
+
+        vector<thread>      _threads;
+        deque<Job*>         _queue;
+        mutex               _lock;
+        condition_variable  _wake;
+        condition_variable  _finished;
+        bool                _stop;
+    };
+
+    // Tasks [head, tail) of one thread of steal, in decreasing order of
+    // cost: the owner pops at the head, thieves at the tail.
+    struct Deque
+    {
+        vector<int> tasks;
+        int         head;
+        int         tail;
+        atomic_flag lock;
+
+        Deque(): head(0), tail(0) { lock.clear(); }
+
+        bool pop(bool front, int &task)
+        {
+            while (lock.test_and_set(memory_order_acquire))
+                ;
+            const bool found = head < tail;
+            if (found)
+                task = front ? tasks[head++] : tasks[--tail];
+            lock.clear(memory_order_release);
+            return found;
+        }
+    };
+
+    struct Stealing
+    {
+        Parallel::Task task;
+        const void    *body;
+        Deque         *deques;
+        int            threads;
+
+        void operator()(int part, Arena &scratch) const
+        {
+            for (int task; ; )
+            {
+                bool found = deques[part].pop(true, task);
+                for (int i = 1; !found && i < threads; i++)
+                    found = deques[(part + i) % threads].pop(false, task);
+                if (!found)
+                    return;
+                this->task(body, task, scratch);
+            }
+        }
+    };
+}
+
+int Parallel::parts(double flops, int threads)
+{
+    return std::max(1, std::min(threads, static_cast<int>(flops / GRAIN)));
+}
+
+void Parallel::run(int parts, Task task, const void *body, Arena &scratch)
+{
+    if (parts <= 1 || Workers::instance().size() == 0)
+    {
+        for (int part = 0; part < parts; part++)
+            task(body, part, scratch);
+        return;
+    }
+    Job job = { task, body, parts, 0, 0 };
+    Workers::instance().run(job, scratch);
+}
+
+void Parallel::steal(int tasks, int threads, Task task, const void *body, Arena &scratch)
+{
+    threads = std::max(1, std::min(std::min(threads, tasks), Parallel::threads()));
+    unique_ptr<Deque[]> deques(new Deque[threads]);
+    for (int t = 0; t < tasks; t++)
+        deques[t % threads].tasks.push_back(t);
+    for (int i = 0; i < threads; i++)
+        deques[i].tail = static_cast<int>(deques[i].tasks.size());
+
+    const Stealing stealing = { task, body, deques.get(), threads };
+    run(threads, stealing, scratch);
+}
+
+int Parallel::threads()
+{
+    return Workers::instance().size() + 1;
+}
@@ -0,0 +1,106 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __parallel__
+#define __parallel__
+
+#include "arena.h"
+
+namespace cnn
+{
+    // Intra-op parallelism: a kernel splits its output into parts (row
+    // bands, tile chunks, ranges of output channels) and runs them on a
+    // process-wide pool of hardware_concurrency() - 1 workers plus the
+    // calling thread. Each worker has an arena of its own for the scratch of
+    // the parts it runs, kept from one call to the next; the caller's parts
+    // use the caller's arena.
+    //
+    // Any number of threads may call run at once. A caller works through
+    // the parts of its own call too, so it finishes even when every worker
+    // is busy elsewhere.
+    class Parallel
+    {
+    public:
+        enum
+        {
+            // Floating point operations below which a part does not pay
+            // for waking a worker (roughly 10-20 us of one core).
+            GRAIN = 1 << 20
+        };
+
+        // Parts worth splitting an op of the given cost into with up to
+        // threads threads: 1 for anything under two GRAINs, such as every
+        // layer of 12cnet on a calibration crop.
+        static int parts(double flops, int threads);
+
+        // body(part, scratch) for every part in [0, parts). Returns when all
+        // of them are done; with a single part it just calls body. Makes no
+        // heap allocation.
+        template<class Body>
+        static void run(int parts, const Body &body, Arena &scratch)
+        {
+            run(parts, &call<Body>, &body, scratch);
+        }
+
+        // Threads run can use at once: the workers and the caller.
+        static int threads();
+
+        // Task parallelism: body(task, scratch) for every task in [0, tasks),
+        // given in decreasing order of cost, on up to threads threads. Each
+        // thread starts on a deque of every threads-th task, largest first,
+        // and once its own is empty steals from the back of the others', so
+        // the small tasks fill in around the large ones. Returns when all of
+        // them are done.
+        template<class Body>
+        static void steal(int tasks, int threads, const Body &body, Arena &scratch)
+        {
+            steal(tasks, threads, &call<Body>, &body, scratch);
+        }
+
+        // A Body behind a pointer, so run does not allocate.
+        typedef void (*Task)(const void *body, int part, Arena &scratch);
+
+    private:
+        template<class Body>
+        static void call(const void *body, int part, Arena &scratch)
+        {
+            (*static_cast<const Body*>(body))(part, scratch);
+        }
+
+        static void run(int parts, Task task, const void *body, Arena &scratch);
+        static void steal(int tasks, int threads, Task task, const void *body, Arena &scratch);
+    };
+}
+
+#endif
@@ -0,0 +1,176 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "pool.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+using namespace cnn::simd;
+
+namespace
+{
+    typedef MaxPool::Window Window;
+
+    void horizontal(const float *in, int cols, int lanes,
+                    const Window &window,
+                    float *out, int outputW)
+    {
+        for (int ox = 0; ox < outputW; ox++, out += lanes)
+        {
+            const int x0 = std::max(ox * window.strideW - window.padW, 0);
+            const int x1 = std::min(ox * window.strideW - window.padW + window.width, cols);
+            if (lanes == 8)
+            {
+                v8f m = load(in + x0 * 8);
+                for (int x = x0 + 1; x < x1; x++)
+                    m = max(m, load(in + x * 8));
+                store(out, m);
+                continue;
+            }
+            for (int l = 0; l < lanes; l++)
+            {
+                float m = in[x0 * lanes + l];
+                for (int x = x0 + 1; x < x1; x++)
+                    m = std::max(m, in[x * lanes + l]);
+                out[l] = m;
+            }
+        }
+    }
+
+    void vertical(const float *const *rows, int n,
+                  float *out, size_t count, bool relu)
+    {
+        const v8f floor = set1(relu ? 0.f : std::numeric_limits<float>::lowest());
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            v8f m = max(load(rows[0] + i), floor);
+            for (int r = 1; r < n; r++)
+                m = max(m, load(rows[r] + i));
+            store(out + i, m);
+        }
+        if (i < count)
+        {
+            const int tail = static_cast<int>(count - i);
+            v8f m = max(loadPartial(rows[0] + i, tail), floor);
+            for (int r = 1; r < n; r++)
+                m = max(m, loadPartial(rows[r] + i, tail));
+            storePartial(out + i, m, tail);
+        }
+    }
+
+    void pool(const float *in, size_t inputRow, int rows, int cols, int lanes,
+              const Window &window,
+              float *out, size_t outputRow, int outputW, int outputH,
+              bool relu, Arena &scratch)
+    {
+        // Horizontally pooled rows, window.height of them in a ring.
+        const size_t width  = static_cast<size_t>(outputW) * lanes;
+        const size_t mark   = scratch.mark();
+        float *_ring        = scratch.allocate<float>(window.height * width);
+        const float **_rows = scratch.allocate<const float*>(window.height);
+
+        int next = 0;
+        for (int oy = 0; oy < outputH; oy++, out += outputRow)
+        {
+            const int y0 = std::max(oy * window.strideH - window.padH, 0);
+            const int y1 = std::min(oy * window.strideH - window.padH + window.height, rows);
+            for (int y = std::max(next, y0); y < y1; y++)
+                horizontal(in + y * inputRow, cols, lanes, window, &_ring[(y % window.height) * width], outputW);
+            next = std::max(next, y1);
+
+            for (int y = y0; y < y1; y++)
+                _rows[y - y0] = &_ring[(y % window.height) * width];
+            vertical(&_rows[0], y1 - y0, out, width, relu);
+        }
+        scratch.release(mark);
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindPool(Kernels &kernels)
+        {
+            kernels.horizontal = horizontal;
+            kernels.vertical   = vertical;
+            kernels.pool       = pool;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+void MaxPool::horizontal(const float *in, int cols, int lanes,
+                         const Window &window,
+                         float *out, int outputW)
+{
+    Isa::kernels().horizontal(in, cols, lanes, window, out, outputW);
+}
+
+void MaxPool::vertical(const float *const *rows, int n,
+                       float *out, size_t count, bool relu)
+{
+    Isa::kernels().vertical(rows, n, out, count, relu);
+}
+
+void MaxPool::pool(const float *in, size_t inputRow, int rows, int cols, int lanes,
+                   const Window &window,
+                   float *out, size_t outputRow, int outputW, int outputH,
+                   bool relu, Arena &scratch)
+{
+    Isa::kernels().pool(in, inputRow, rows, cols, lanes, window, out, outputRow, outputW, outputH, relu, scratch);
+}
+
+void MaxPool::band(const Window &window, int rows, int y0, int y1,
+                   int &r0, int &r1, Window &band)
+{
+    r0 = std::max(y0 * window.strideH - window.padH, 0);
+    r1 = std::min((y1 - 1) * window.strideH - window.padH + window.height, rows);
+    band = window;
+    band.padH = std::max(window.padH - y0 * window.strideH, 0);
+}
+
+size_t MaxPool::scratchSize(const Window &window, int outputW, int lanes)
+{
+    return Arena::align(window.height * static_cast<size_t>(outputW) * lanes * sizeof(float)) +
+           Arena::align(window.height * sizeof(const float*));
+}
+
+#endif
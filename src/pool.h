@@ -0,0 +1,95 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __pool__
+#define __pool__
+
+#include <cstddef>
+#include "arena.h"
+
+namespace cnn
+{
+    // Separable max pooling: every input row is pooled horizontally once,
+    // then each output row is the element-wise max of the window's pooled
+    // rows. Windows are clipped at the borders instead of padding the input,
+    // which gives the same result since the padding never wins a max.
+    //
+    // Pixels are `lanes` consecutive floats (1 for planes, 8 for blocked
+    // tensors, where a pixel is one SIMD register).
+    class MaxPool
+    {
+    public:
+        struct Window
+        {
+            int width;
+            int height;
+            int strideW;
+            int strideH;
+            int padW;
+            int padH;
+        };
+
+        static int outputSize(int input, int window, int stride, int pad)
+        {
+            return (input + 2 * pad - window) / stride + 1;
+        }
+
+        // out[ox] = max of in over the clipped window starting at ox * strideW - padW.
+        static void horizontal(const float *in, int cols, int lanes,
+                               const Window &window,
+                               float *out, int outputW);
+
+        // out = element-wise max of n rows of count floats, clamped at zero with relu.
+        static void vertical(const float *const *rows, int n,
+                             float *out, size_t count, bool relu);
+
+        // Pools rows x cols pixels (rows inputRow floats apart) into
+        // outputH x outputW pixels (rows outputRow floats apart).
+        static void pool(const float *in, size_t inputRow, int rows, int cols, int lanes,
+                         const Window &window,
+                         float *out, size_t outputRow, int outputW, int outputH,
+                         bool relu, Arena &scratch);
+
+        // Output rows [y0, y1) of a map of `rows` rows pooled on their own:
+        // they only need input rows [r0, r1), pooled with band, the window
+        // with its padding relative to r0.
+        static void band(const Window &window, int rows, int y0, int y1,
+                         int &r0, int &r1, Window &band);
+
+        // Bytes of scratch pool() takes from the arena.
+        static size_t scratchSize(const Window &window, int outputW, int lanes);
+    };
+}
+
+#endif
@@ -0,0 +1,253 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "quant.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+
+namespace
+{
+#ifdef CNN_SIMD_AVX2
+    // acc + the 4-way dot products of u8 a and s8 w per int32 lane.
+    static inline __m256i dot(__m256i acc, __m256i a, __m256i w)
+    {
+#if defined(__AVXVNNI__)
+        return _mm256_dpbusd_avx_epi32(acc, a, w);
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+        return _mm256_dpbusd_epi32(acc, a, w);
+#else
+        return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, w), _mm256_set1_epi16(1)));
+#endif
+    }
+
+    // PX pixels x NB output blocks of accumulators.
+    template<int PX, int NB>
+    void tile(int G, const uint8_t *cols, size_t rowSize,
+              const int8_t *w, size_t weightBlock, int32_t *acc, size_t accRow)
+    {
+        __m256i c[PX][NB];
+        for (int p = 0; p < PX; p++)
+            for (int b = 0; b < NB; b++)
+                c[p][b] = _mm256_setzero_si256();
+
+        for (int g = 0; g < G; g++)
+        {
+            __m256i wv[NB];
+            for (int b = 0; b < NB; b++)
+                wv[b] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + b * weightBlock + g * Quant::BLOCK * Quant::GROUP));
+            for (int p = 0; p < PX; p++)
+            {
+                int32_t four;
+                memcpy(&four, cols + p * rowSize + g * Quant::GROUP, sizeof(four));
+                const __m256i a = _mm256_set1_epi32(four);
+                for (int b = 0; b < NB; b++)
+                    c[p][b] = dot(c[p][b], a, wv[b]);
+            }
+        }
+
+        for (int p = 0; p < PX; p++)
+            for (int b = 0; b < NB; b++)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + p * accRow + b * Quant::BLOCK), c[p][b]);
+    }
+#else
+    template<int PX, int NB>
+    void tile(int G, const uint8_t *cols, size_t rowSize,
+              const int8_t *w, size_t weightBlock, int32_t *acc, size_t accRow)
+    {
+        for (int p = 0; p < PX; p++)
+            for (int b = 0; b < NB; b++)
+                for (int l = 0; l < Quant::BLOCK; l++)
+                {
+                    int32_t s = 0;
+                    for (int g = 0; g < G; g++)
+                        for (int i = 0; i < Quant::GROUP; i++)
+                            s += cols[p * rowSize + g * Quant::GROUP + i] *
+                                 w[b * weightBlock + (g * Quant::BLOCK + l) * Quant::GROUP + i];
+                    acc[p * accRow + b * Quant::BLOCK + l] = s;
+                }
+    }
+#endif
+
+    void quantize(const float *x, size_t n, const Quant::Activation &a, uint8_t *q)
+    {
+        const float inv = 1.f / a.scale;
+        size_t i = 0;
+#ifdef CNN_SIMD_AVX2
+        const __m256  _inv  = _mm256_set1_ps(inv);
+        const __m256i _zero = _mm256_set1_epi32(a.zero);
+        const __m256i _low  = _mm256_setzero_si256();
+        const __m256i _high = _mm256_set1_epi32(Quant::LEVELS);
+        const __m256i _pick = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i v = _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + i), _inv)), _zero);
+            v = _mm256_min_epi32(_mm256_max_epi32(v, _low), _high);
+            // 32 -> 16 -> 8 bits within each 128-bit lane, then join the lanes.
+            v = _mm256_packus_epi16(_mm256_packus_epi32(v, v), v);
+            v = _mm256_permutevar8x32_epi32(v, _pick);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(q + i), _mm256_castsi256_si128(v));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            const int v = static_cast<int>(std::lrint(x[i] * inv)) + a.zero;
+            q[i] = static_cast<uint8_t>(std::min(std::max(v, 0), static_cast<int>(Quant::LEVELS)));
+        }
+    }
+
+    void dequantize(const int32_t *acc, int n, const float *scales,
+                    const float *offsets, bool relu, float *out)
+    {
+        int i = 0;
+#ifdef CNN_SIMD_AVX2
+        const __m256 _floor = _mm256_set1_ps(relu ? 0.f : -std::numeric_limits<float>::infinity());
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m256 v = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i)));
+            _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_fmadd_ps(v, _mm256_loadu_ps(scales + i), _mm256_loadu_ps(offsets + i)), _floor));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            const float value = scales[i] * acc[i] + offsets[i];
+            out[i] = relu ? std::max(value, 0.f) : value;
+        }
+    }
+
+    void gemm(int nLayers, int N, int K, const uint8_t *cols,
+              const int8_t *packed, int32_t *acc, size_t accRow)
+    {
+        const int G              = Quant::groups(K);
+        const size_t row         = Quant::rowSize(K);
+        const size_t weightBlock = static_cast<size_t>(G) * Quant::BLOCK * Quant::GROUP;
+        const int blocks         = (nLayers + Quant::BLOCK - 1) / Quant::BLOCK;
+
+        for (int ob = 0; ob < blocks; )
+        {
+            const int nb     = (blocks - ob >= 2) ? 2 : 1;
+            const int8_t *w  = packed + ob * weightBlock;
+            int32_t *out     = acc + ob * Quant::BLOCK;
+            int n = 0;
+            for (; n + 4 <= N; n += 4)
+            {
+                if (nb == 2)
+                    tile<4, 2>(G, cols + n * row, row, w, weightBlock, out + n * accRow, accRow);
+                else
+                    tile<4, 1>(G, cols + n * row, row, w, weightBlock, out + n * accRow, accRow);
+            }
+            for (; n < N; n++)
+            {
+                if (nb == 2)
+                    tile<1, 2>(G, cols + n * row, row, w, weightBlock, out + n * accRow, accRow);
+                else
+                    tile<1, 1>(G, cols + n * row, row, w, weightBlock, out + n * accRow, accRow);
+            }
+            ob += nb;
+        }
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindQuant(Kernels &kernels)
+        {
+            kernels.quantize   = quantize;
+            kernels.dequantize = dequantize;
+            kernels.qgemm      = gemm;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+Quant::Activation Quant::activation(float minimum, float maximum)
+{
+    minimum = std::min(minimum, 0.f);
+    maximum = std::max(maximum, 0.f);
+    Activation a;
+    a.scale = (maximum > minimum) ? (maximum - minimum) / LEVELS : 1.f;
+    a.zero  = std::min(std::max(static_cast<int>(std::lround(-minimum / a.scale)), 0), static_cast<int>(LEVELS));
+    return a;
+}
+
+void Quant::packWeights(int nLayers, int K, const float *weights,
+                        int8_t *packed, float *scales, int32_t *sums)
+{
+    const int G = groups(K);
+    memset(packed, 0, packedSize(nLayers, K));
+    for (int m = 0; m < nLayers; m++)
+    {
+        const float *row = weights + static_cast<size_t>(m) * K;
+        float _max = 0.f;
+        for (int k = 0; k < K; k++)
+            _max = std::max(_max, std::fabs(row[k]));
+        scales[m] = (_max > 0.f) ? _max / LEVELS : 1.f;
+        sums[m]   = 0;
+
+        int8_t *dst = packed + (static_cast<size_t>(m / BLOCK) * G * BLOCK + m % BLOCK) * GROUP;
+        for (int k = 0; k < K; k++)
+        {
+            const int q = static_cast<int>(std::lround(row[k] / scales[m]));
+            dst[(k / GROUP) * BLOCK * GROUP + k % GROUP] = static_cast<int8_t>(q);
+            sums[m] += q;
+        }
+    }
+}
+
+void Quant::quantize(const float *x, size_t n, const Activation &a, uint8_t *q)
+{
+    Isa::kernels().quantize(x, n, a, q);
+}
+
+void Quant::dequantize(const int32_t *acc, int n, const float *scales,
+                       const float *offsets, bool relu, float *out)
+{
+    Isa::kernels().dequantize(acc, n, scales, offsets, relu, out);
+}
+
+void Quant::gemm(int nLayers, int N, int K, const uint8_t *cols,
+                 const int8_t *packed, int32_t *acc, size_t accRow)
+{
+    Isa::kernels().qgemm(nLayers, N, K, cols, packed, acc, accRow);
+}
+
+#endif
@@ -0,0 +1,110 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __quant__
+#define __quant__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cnn
+{
+    // Int8 convolution as a GEMM of unsigned activation codes by signed
+    // weight codes with int32 accumulation: vpdpbusd on CPUs with AVX-VNNI
+    // or AVX512-VNNI (Isa::vnni), pmaddubsw + pmaddwd otherwise.
+    //
+    // Activations use 7 bits, q in [0, 127], so that the pairwise sums of
+    // pmaddubsw (at most 2 * 127 * 127) never saturate and both paths give
+    // the same results. Weights are quantized symmetrically per output
+    // channel to [-127, 127].
+    //
+    // The reduction index k runs over (ky, kx, channel) and is consumed four
+    // codes at a time: packed weights are [nLayers / 8][groups(K)][8][4].
+    class Quant
+    {
+    public:
+        enum
+        {
+            BLOCK  = 8,     // output channels per SIMD register of int32
+            GROUP  = 4,     // codes per int32 lane of a dot product
+            LEVELS = 127    // largest activation and weight code
+        };
+
+        // x ~= scale * (q - zero)
+        struct Activation
+        {
+            float scale;
+            int   zero;
+        };
+
+        // Asymmetric 7-bit mapping of [minimum, maximum] (widened to hold 0,
+        // so that zero padding is exact).
+        static Activation activation(float minimum, float maximum);
+
+        static int groups(int K)
+        {
+            return (K + GROUP - 1) / GROUP;
+        }
+        // Bytes of packed weights, and of one pixel of im2col codes.
+        static size_t packedSize(int nLayers, int K)
+        {
+            return static_cast<size_t>((nLayers + BLOCK - 1) / BLOCK) * groups(K) * BLOCK * GROUP;
+        }
+        static size_t rowSize(int K)
+        {
+            return static_cast<size_t>(groups(K)) * GROUP;
+        }
+
+        // Quantizes row-major weights[nLayers x K] into the packed layout.
+        // scales[m] is the step of row m and sums[m] the sum of its codes.
+        static void packWeights(int nLayers, int K, const float *weights,
+                                int8_t *packed, float *scales, int32_t *sums);
+
+        // Codes of n values.
+        static void quantize(const float *x, size_t n, const Activation &a, uint8_t *q);
+
+        // out[i] = scales[i] * acc[i] + offsets[i] for n values, clamped at
+        // zero with relu.
+        static void dequantize(const int32_t *acc, int n, const float *scales,
+                               const float *offsets, bool relu, float *out);
+
+        // acc[n * accRow + m] = sum_k cols[n * rowSize(K) + k] * w[m][k]
+        // for N pixels and all output blocks (accRow >= nLayers rounded up
+        // to BLOCK).
+        static void gemm(int nLayers, int N, int K, const uint8_t *cols,
+                         const int8_t *packed, int32_t *acc, size_t accRow);
+    };
+}
+
+#endif
@@ -0,0 +1,338 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+
+#include <algorithm>
+#include <cmath>
+#include "resample.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+using namespace cnn::simd;
+
+namespace
+{
+    typedef Resample::Taps Taps;
+
+    // Pixels [x, outputW) from the taps.
+    template<typename T>
+    void gather(const T *in, const Taps &taps, int x, int outputW, float *out)
+    {
+        const int width = taps.width;
+        for (; x < outputW; x++)
+        {
+            const int   *index  = &taps.index[x * width];
+            const float *weight = &taps.weight[x * width];
+            float sum = 0.f;
+            for (int t = 0; t < width; t++)
+                sum += weight[t] * in[index[t]];
+            out[x] = sum;
+        }
+    }
+
+    // Halving cells: the means of pairs of pixels, eight at a time.
+    void areaRow8(const uint8_t *in, const Taps &taps, int outputW, float *out)
+    {
+        int x = 0;
+        if (taps.box == 2)
+        {
+            const v8f half = set1(.5f);
+            for (; x + 8 <= taps.inner; x += 8)
+            {
+                v8f even, odd;
+                deinterleave(loadU8(in + 2 * x), loadU8(in + 2 * x + 8), even, odd);
+                store(out + x, mul(add(even, odd), half));
+            }
+        }
+        gather(in, taps, x, outputW, out);
+    }
+
+    void areaRow(const float *in, const Taps &taps, int outputW, float *out)
+    {
+        int x = 0;
+        if (taps.box == 2)
+        {
+            const v8f half = set1(.5f);
+            for (; x + 8 <= taps.inner; x += 8)
+            {
+                v8f even, odd;
+                deinterleave(load(in + 2 * x), load(in + 2 * x + 8), even, odd);
+                store(out + x, mul(add(even, odd), half));
+            }
+        }
+        gather(in, taps, x, outputW, out);
+    }
+
+    void areaRows(const float *const *rows, const float *weights, int n,
+                  float *out, size_t count, float mean, float scale)
+    {
+        const v8f _mean  = set1(mean);
+        const v8f _scale = set1(scale);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            v8f sum = mul(set1(weights[0]), load(rows[0] + i));
+            for (int r = 1; r < n; r++)
+                sum = fmadd(set1(weights[r]), load(rows[r] + i), sum);
+            store(out + i, mul(sub(sum, _mean), _scale));
+        }
+        if (i < count)
+        {
+            const int tail = static_cast<int>(count - i);
+            v8f sum = mul(set1(weights[0]), loadPartial(rows[0] + i, tail));
+            for (int r = 1; r < n; r++)
+                sum = fmadd(set1(weights[r]), loadPartial(rows[r] + i, tail), sum);
+            storePartial(out + i, mul(sub(sum, _mean), _scale), tail);
+        }
+    }
+
+    // Rows sum in 32 bits, which holds the squares of 66051 pixels.
+    void moments(const uint8_t *in, size_t inputRow, int rows, int cols,
+                 uint64_t &sum, uint64_t &squares)
+    {
+        sum = squares = 0;
+        for (int y = 0; y < rows; y++, in += inputRow)
+        {
+            uint32_t s = 0, q = 0;
+            for (int x = 0; x < cols; x++)
+            {
+                s += in[x];
+                q += static_cast<uint32_t>(in[x]) * in[x];
+            }
+            sum     += s;
+            squares += q;
+        }
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindResample(Kernels &kernels)
+        {
+            kernels.areaRow8 = areaRow8;
+            kernels.areaRow  = areaRow;
+            kernels.areaRows = areaRows;
+            kernels.moments  = moments;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+namespace
+{
+    template<typename T>
+    void resample(const T *in, size_t inputRow, const Taps &columns, const Taps &rows,
+                  float mean, float norm,
+                  float *out, size_t outputRow, int outputW, int outputH, Arena &scratch)
+    {
+        // Horizontally resampled rows, as many in a ring as a cell spans.
+        const int span      = rows.width;
+        const size_t mark   = scratch.mark();
+        float *_ring        = scratch.allocate<float>(span * static_cast<size_t>(outputW));
+        const float **_cell = scratch.allocate<const float*>(span);
+
+        int next = 0;
+        for (int oy = 0; oy < outputH; oy++, out += outputRow)
+        {
+            const int   *index  = &rows.index[oy * span];
+            const float *weight = &rows.weight[oy * span];
+            for (int y = std::max(next, index[0]); y <= index[span - 1]; y++)
+                Resample::horizontal(in + y * inputRow, columns, outputW, &_ring[(y % span) * outputW]);
+            next = std::max(next, index[span - 1] + 1);
+
+            for (int t = 0; t < span; t++)
+                _cell[t] = &_ring[(index[t] % span) * outputW];
+            Resample::vertical(_cell, weight, span, out, outputW, mean, norm);
+        }
+        scratch.release(mark);
+    }
+
+    template<typename T>
+    void area(const T *in, size_t inputRow, int rows, int cols, double scale,
+              float mean, float norm,
+              float *out, size_t outputRow, int outputW, int outputH, Arena &scratch)
+    {
+        Taps _columns, _rows;
+        Resample::taps(cols, outputW, scale, _columns);
+        Resample::taps(rows, outputH, scale, _rows);
+        resample(in, inputRow, _columns, _rows, mean, norm, out, outputRow, outputW, outputH, scratch);
+    }
+}
+
+void Resample::taps(int size, int outputSize, double scale, Taps &taps)
+{
+    // Per pixel first, then padded to the widest with weightless copies of
+    // the last tap.
+    std::vector<int>   begin(1, 0), index;
+    std::vector<float> weight;
+    for (int x = 0; x < outputSize; x++)
+    {
+        const double fx1  = x * scale, fx2 = fx1 + scale;
+        const double cell = std::min(scale, size - fx1);
+        const int x2 = std::min(static_cast<int>(std::floor(fx2)), size - 1);
+        const int x1 = std::min(static_cast<int>(std::ceil(fx1)), x2);
+        if (x1 - fx1 > 1e-3)
+        {
+            index.push_back(x1 - 1);
+            weight.push_back(static_cast<float>((x1 - fx1) / cell));
+        }
+        for (int i = x1; i < x2; i++)
+        {
+            index.push_back(i);
+            weight.push_back(static_cast<float>(1. / cell));
+        }
+        if (fx2 - x2 > 1e-3)
+        {
+            index.push_back(x2);
+            weight.push_back(static_cast<float>(std::min(std::min(fx2 - x2, 1.), cell) / cell));
+        }
+        begin.push_back(static_cast<int>(index.size()));
+    }
+
+    taps.width = 1;
+    for (int x = 0; x < outputSize; x++)
+        taps.width = std::max(taps.width, begin[x + 1] - begin[x]);
+    taps.index.assign(static_cast<size_t>(outputSize) * taps.width, 0);
+    taps.weight.assign(static_cast<size_t>(outputSize) * taps.width, 0.f);
+    for (int x = 0; x < outputSize; x++)
+        for (int t = 0; t < taps.width; t++)
+        {
+            const int i = std::min(begin[x] + t, begin[x + 1] - 1);
+            taps.index[x * taps.width + t]  = index[i];
+            taps.weight[x * taps.width + t] = (begin[x] + t < begin[x + 1]) ? weight[i] : 0.f;
+        }
+
+    const double box = std::floor(scale + .5);
+    taps.box   = (box >= 1. && std::abs(scale - box) < 1e-6) ? static_cast<int>(box) : 0;
+    taps.inner = taps.box ? std::min(outputSize, size / taps.box) : 0;
+}
+
+void Resample::linearTaps(int size, int outputSize, double scale, Taps &taps)
+{
+    taps.width = 2;
+    taps.box   = 0;
+    taps.inner = 0;
+    taps.index.resize(2 * static_cast<size_t>(outputSize));
+    taps.weight.resize(2 * static_cast<size_t>(outputSize));
+    for (int x = 0; x < outputSize; x++)
+    {
+        int x0 = static_cast<int>(std::floor(x * scale));
+        float f = static_cast<float>((x + 1) - (x0 + 1) / scale);
+        f = (f <= 0.f) ? 0.f : f - std::floor(f);
+        if (x0 < 0)
+            x0 = 0, f = 0.f;
+        if (x0 >= size - 1)
+            x0 = size - 1, f = 0.f;
+        taps.index[2 * x]      = x0;
+        taps.index[2 * x + 1]  = std::min(x0 + 1, size - 1);
+        taps.weight[2 * x]     = 1.f - f;
+        taps.weight[2 * x + 1] = f;
+    }
+}
+
+void Resample::horizontal(const uint8_t *in, const Taps &taps, int outputW, float *out)
+{
+    Isa::kernels().areaRow8(in, taps, outputW, out);
+}
+
+void Resample::horizontal(const float *in, const Taps &taps, int outputW, float *out)
+{
+    Isa::kernels().areaRow(in, taps, outputW, out);
+}
+
+void Resample::vertical(const float *const *rows, const float *weights, int n,
+                        float *out, size_t count, float mean, float scale)
+{
+    Isa::kernels().areaRows(rows, weights, n, out, count, mean, scale);
+}
+
+void Resample::area(const uint8_t *in, size_t inputRow, int rows, int cols, double scale,
+                    float mean, float norm,
+                    float *out, size_t outputRow, int outputW, int outputH, Arena &scratch)
+{
+    ::area(in, inputRow, rows, cols, scale, mean, norm, out, outputRow, outputW, outputH, scratch);
+}
+
+void Resample::area(const float *in, size_t inputRow, int rows, int cols, double scale,
+                    float mean, float norm,
+                    float *out, size_t outputRow, int outputW, int outputH, Arena &scratch)
+{
+    ::area(in, inputRow, rows, cols, scale, mean, norm, out, outputRow, outputW, outputH, scratch);
+}
+
+float Resample::pixel(const uint8_t *in, size_t inputRow, const Taps &columns, const Taps &rows,
+                      int x, int y)
+{
+    float sum = 0.f;
+    for (int t = 0; t < rows.width; t++)
+    {
+        const uint8_t *row = in + rows.index[y * rows.width + t] * inputRow;
+        float _row = 0.f;
+        for (int u = 0; u < columns.width; u++)
+            _row += columns.weight[x * columns.width + u] * row[columns.index[x * columns.width + u]];
+        sum += rows.weight[y * rows.width + t] * _row;
+    }
+    return sum;
+}
+
+void Resample::resize(const float *in, size_t inputRow, int rows, int cols,
+                      float *out, size_t outputRow, int outputW, int outputH, Arena &scratch)
+{
+    const double scaleW = static_cast<double>(cols) / outputW;
+    const double scaleH = static_cast<double>(rows) / outputH;
+    Taps _columns, _rows;
+    if (scaleW >= 1. && scaleH >= 1.)
+    {
+        taps(cols, outputW, scaleW, _columns);
+        taps(rows, outputH, scaleH, _rows);
+    }
+    else
+    {
+        linearTaps(cols, outputW, scaleW, _columns);
+        linearTaps(rows, outputH, scaleH, _rows);
+    }
+    resample(in, inputRow, _columns, _rows, 0.f, 1.f, out, outputRow, outputW, outputH, scratch);
+}
+
+void Resample::moments(const uint8_t *in, size_t inputRow, int rows, int cols,
+                       uint64_t &sum, uint64_t &squares)
+{
+    Isa::kernels().moments(in, inputRow, rows, cols, sum, squares);
+}
+
+#endif
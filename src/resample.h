@@ -0,0 +1,104 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+
+#ifndef __resample__
+#define __resample__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "arena.h"
+
+namespace cnn
+{
+    // Area resampling (INTER_AREA downscaling) of single channel images,
+    // separable like MaxPool: every input row is resampled horizontally
+    // once, then each output row is the weighted sum of the resampled rows
+    // its cell covers, normalized on the way as (sum - mean) * scale. An
+    // 8-bit image so becomes a normalized float level in one pass.
+    class Resample
+    {
+    public:
+        // The input pixels under each output pixel: a cell of scale pixels
+        // clipped at the border, as OpenCV's INTER_AREA weighs them. Every
+        // output pixel has width taps; the ones it lacks weigh 0.
+        struct Taps
+        {
+            int width;
+            int box;                    // scale, when it is a whole number of pixels,
+            int inner;                  // for the first inner pixels, which are unclipped
+            std::vector<int>   index;   // outputSize * width
+            std::vector<float> weight;
+        };
+        static void taps(int size, int outputSize, double scale, Taps &taps);
+        // The two taps INTER_AREA takes when it does not shrink both ways:
+        // a pixel blends into the next over the part of its cell past it.
+        static void linearTaps(int size, int outputSize, double scale, Taps &taps);
+
+        // out[x] = sum of the taps of x in in.
+        static void horizontal(const uint8_t *in, const Taps &taps, int outputW, float *out);
+        static void horizontal(const float *in, const Taps &taps, int outputW, float *out);
+
+        // out = (sum of weights[r] * rows[r] - mean) * scale, count floats.
+        static void vertical(const float *const *rows, const float *weights, int n,
+                             float *out, size_t count, float mean, float scale);
+
+        // Resamples rows x cols pixels (rows inputRow elements apart) by
+        // scale input pixels per output pixel into outputH x outputW floats
+        // (rows outputRow floats apart), normalized with mean and norm.
+        static void area(const uint8_t *in, size_t inputRow, int rows, int cols, double scale,
+                         float mean, float norm,
+                         float *out, size_t outputRow, int outputW, int outputH, Arena &scratch);
+        static void area(const float *in, size_t inputRow, int rows, int cols, double scale,
+                         float mean, float norm,
+                         float *out, size_t outputRow, int outputW, int outputH, Arena &scratch);
+
+        // Pixel (x, y) of the output of area() with these taps, before it
+        // is normalized.
+        static float pixel(const uint8_t *in, size_t inputRow, const Taps &columns, const Taps &rows,
+                           int x, int y);
+
+        // cv::resize(..., INTER_AREA) of rows x cols floats to outputW x
+        // outputH: area cells when it shrinks both ways, linearTaps when not.
+        static void resize(const float *in, size_t inputRow, int rows, int cols,
+                           float *out, size_t outputRow, int outputW, int outputH, Arena &scratch);
+
+        // Sum and sum of squares of the pixels of rows x cols 8-bit pixels.
+        static void moments(const uint8_t *in, size_t inputRow, int rows, int cols,
+                            uint64_t &sum, uint64_t &squares);
+    };
+}
+
+#endif
@@ -0,0 +1,433 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __simd__
+#define __simd__
+
+#include <algorithm>
+#include <cmath>
+#include "half.h"
+#include "isa.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CNN_SIMD_AVX2 1
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define CNN_SIMD_SSE4 1
+#endif
+
+namespace cnn
+{
+    // Eight float lanes. Maps onto one AVX2 register when the kernels are
+    // built with AVX2/FMA, onto a pair of SSE registers with SSE4.1 and onto
+    // a plain array otherwise, so the templated kernels compile (and
+    // auto-vectorize as well as they can) everywhere.
+    namespace simd
+    {
+    // One copy per ISA level: v8f and the Fp32/Fp16/Bf16 loaders are types
+    // whose inline members must not be merged across levels by the linker.
+    inline namespace CNN_ISA
+    {
+#ifdef CNN_SIMD_AVX2
+        typedef __m256 v8f;
+
+        static inline v8f zero()                        { return _mm256_setzero_ps(); }
+        static inline v8f set1(float a)                 { return _mm256_set1_ps(a); }
+        static inline v8f load(const float *p)          { return _mm256_loadu_ps(p); }
+        static inline void store(float *p, v8f a)       { _mm256_storeu_ps(p, a); }
+        static inline v8f add(v8f a, v8f b)             { return _mm256_add_ps(a, b); }
+        static inline v8f sub(v8f a, v8f b)             { return _mm256_sub_ps(a, b); }
+        static inline v8f mul(v8f a, v8f b)             { return _mm256_mul_ps(a, b); }
+        static inline v8f div(v8f a, v8f b)             { return _mm256_div_ps(a, b); }
+        static inline v8f max(v8f a, v8f b)             { return _mm256_max_ps(a, b); }
+        // a * b + c
+        static inline v8f fmadd(v8f a, v8f b, v8f c)    { return _mm256_fmadd_ps(a, b, c); }
+
+        // e^a to about 2 ulp (Cephes expf): a = n ln2 + r, e^r by a degree 6
+        // polynomial, 2^n built in the exponent bits. a is clamped so that
+        // n stays a normal exponent; large negative inputs give ~1e-38.
+        static inline v8f exp(v8f a)
+        {
+            a = _mm256_min_ps(_mm256_max_ps(a, _mm256_set1_ps(-87.33f)), _mm256_set1_ps(88.37f));
+            const v8f n = _mm256_round_ps(_mm256_mul_ps(a, _mm256_set1_ps(1.44269504088896341f)),
+                                          _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            v8f r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), a);
+            r     = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+            v8f p = _mm256_set1_ps(1.9875691500e-4f);
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+            p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+            const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+            return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+        }
+
+        // Splits 16 interleaved floats a0 a1 a2 ... b7 into the even and odd ones.
+        static inline void deinterleave(v8f a, v8f b, v8f &even, v8f &odd)
+        {
+            const __m256 e = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m256 o = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            even = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(e), _MM_SHUFFLE(3, 1, 2, 0)));
+            odd  = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(o), _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+
+        // Eight fp16 or bf16 values widened to float.
+        static inline v8f loadFp16(const uint16_t *p)
+        {
+#ifdef __F16C__
+            return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+#else
+            float f[8];
+            for (int i = 0; i < 8; i++) f[i] = Half::widen(p[i], Half::FP16);
+            return _mm256_loadu_ps(f);
+#endif
+        }
+        static inline v8f loadBf16(const uint16_t *p)
+        {
+            const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+            return _mm256_castsi256_ps(_mm256_slli_epi32(v, 16));
+        }
+
+        // Eight 8-bit pixels widened to float.
+        static inline v8f loadU8(const uint8_t *p)
+        {
+            return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+        }
+
+        // p[0], p[S], ..., p[7 * S]
+        template<int S>
+        static inline v8f loadStrided(const float *p)
+        {
+            if (S == 1)
+                return _mm256_loadu_ps(p);
+            const __m256i idx = _mm256_setr_epi32(0, S, 2 * S, 3 * S, 4 * S, 5 * S, 6 * S, 7 * S);
+            return _mm256_i32gather_ps(p, idx, 4);
+        }
+
+        // First n (< 8) lanes of p, zero elsewhere.
+        static inline v8f loadPartial(const float *p, int n)
+        {
+            const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i mask  = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes);
+            return _mm256_maskload_ps(p, mask);
+        }
+
+        // Stores the first n (< 8) lanes of a.
+        static inline void storePartial(float *p, v8f a, int n)
+        {
+            const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i mask  = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes);
+            _mm256_maskstore_ps(p, mask, a);
+        }
+
+        static inline void prefetch(const float *p)     { _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0); }
+
+        static inline float hsum(v8f a)
+        {
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+
+        static inline float hmax(v8f a)
+        {
+            __m128 m = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+            m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+            m = _mm_max_ss(m, _mm_movehdup_ps(m));
+            return _mm_cvtss_f32(m);
+        }
+
+        // Bit l set where lane l of a is greater than that of b.
+        static inline int greater(v8f a, v8f b)         { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+#elif defined(CNN_SIMD_SSE4)
+        struct v8f
+        {
+            __m128 lo;
+            __m128 hi;
+        };
+
+        static inline v8f make(__m128 lo, __m128 hi)    { v8f r; r.lo = lo; r.hi = hi; return r; }
+        static inline v8f zero()                        { return make(_mm_setzero_ps(), _mm_setzero_ps()); }
+        static inline v8f set1(float a)                 { return make(_mm_set1_ps(a), _mm_set1_ps(a)); }
+        static inline v8f load(const float *p)          { return make(_mm_loadu_ps(p), _mm_loadu_ps(p + 4)); }
+        static inline void store(float *p, v8f a)       { _mm_storeu_ps(p, a.lo); _mm_storeu_ps(p + 4, a.hi); }
+        static inline v8f add(v8f a, v8f b)             { return make(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)); }
+        static inline v8f sub(v8f a, v8f b)             { return make(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)); }
+        static inline v8f mul(v8f a, v8f b)             { return make(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)); }
+        static inline v8f div(v8f a, v8f b)             { return make(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)); }
+        static inline v8f max(v8f a, v8f b)             { return make(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)); }
+        // a * b + c, rounded twice
+        static inline v8f fmadd(v8f a, v8f b, v8f c)    { return add(mul(a, b), c); }
+
+        // The AVX2 exp on four lanes.
+        static inline __m128 exp4(__m128 a)
+        {
+            a = _mm_min_ps(_mm_max_ps(a, _mm_set1_ps(-87.33f)), _mm_set1_ps(88.37f));
+            const __m128 n = _mm_round_ps(_mm_mul_ps(a, _mm_set1_ps(1.44269504088896341f)),
+                                          _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            __m128 r = _mm_sub_ps(a, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+            r        = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+            __m128 p = _mm_set1_ps(1.9875691500e-4f);
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), _mm_add_ps(r, _mm_set1_ps(1.f)));
+            const __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+            return _mm_mul_ps(p, _mm_castsi128_ps(e));
+        }
+        static inline v8f exp(v8f a)                    { return make(exp4(a.lo), exp4(a.hi)); }
+
+        static inline void deinterleave(v8f a, v8f b, v8f &even, v8f &odd)
+        {
+            even = make(_mm_shuffle_ps(a.lo, a.hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(b.lo, b.hi, _MM_SHUFFLE(2, 0, 2, 0)));
+            odd  = make(_mm_shuffle_ps(a.lo, a.hi, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(b.lo, b.hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        static inline v8f loadFp16(const uint16_t *p)
+        {
+            float f[8];
+            for (int i = 0; i < 8; i++) f[i] = Half::widen(p[i], Half::FP16);
+            return load(f);
+        }
+        static inline v8f loadBf16(const uint16_t *p)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            return make(_mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), v)),
+                        _mm_castsi128_ps(_mm_unpackhi_epi16(_mm_setzero_si128(), v)));
+        }
+        static inline v8f loadU8(const uint8_t *p)
+        {
+            const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+            return make(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(v)), _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4))));
+        }
+        template<int S>
+        static inline v8f loadStrided(const float *p)
+        {
+            return make(_mm_setr_ps(p[0], p[S], p[2 * S], p[3 * S]),
+                        _mm_setr_ps(p[4 * S], p[5 * S], p[6 * S], p[7 * S]));
+        }
+        static inline v8f loadPartial(const float *p, int n)
+        {
+            float f[8] = {};
+            for (int i = 0; i < n; i++) f[i] = p[i];
+            return load(f);
+        }
+        static inline void storePartial(float *p, v8f a, int n)
+        {
+            float f[8];
+            store(f, a);
+            for (int i = 0; i < n; i++) p[i] = f[i];
+        }
+        static inline void prefetch(const float *p)     { _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0); }
+        static inline float hsum(v8f a)
+        {
+            __m128 s = _mm_add_ps(a.lo, a.hi);
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+        static inline float hmax(v8f a)
+        {
+            __m128 m = _mm_max_ps(a.lo, a.hi);
+            m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+            m = _mm_max_ss(m, _mm_movehdup_ps(m));
+            return _mm_cvtss_f32(m);
+        }
+        static inline int greater(v8f a, v8f b)
+        {
+            return _mm_movemask_ps(_mm_cmpgt_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmpgt_ps(a.hi, b.hi)) << 4);
+        }
+#else
+        struct v8f
+        {
+            float v[8];
+        };
+
+        static inline v8f zero()
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = 0.f;
+            return r;
+        }
+        static inline v8f set1(float a)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = a;
+            return r;
+        }
+        static inline v8f load(const float *p)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = p[i];
+            return r;
+        }
+        static inline void store(float *p, v8f a)
+        {
+            for (int i = 0; i < 8; i++) p[i] = a.v[i];
+        }
+        static inline v8f add(v8f a, v8f b)
+        {
+            for (int i = 0; i < 8; i++) a.v[i] += b.v[i];
+            return a;
+        }
+        static inline v8f sub(v8f a, v8f b)
+        {
+            for (int i = 0; i < 8; i++) a.v[i] -= b.v[i];
+            return a;
+        }
+        static inline v8f mul(v8f a, v8f b)
+        {
+            for (int i = 0; i < 8; i++) a.v[i] *= b.v[i];
+            return a;
+        }
+        static inline v8f div(v8f a, v8f b)
+        {
+            for (int i = 0; i < 8; i++) a.v[i] /= b.v[i];
+            return a;
+        }
+        static inline v8f max(v8f a, v8f b)
+        {
+            for (int i = 0; i < 8; i++) a.v[i] = (a.v[i] > b.v[i]) ? a.v[i] : b.v[i];
+            return a;
+        }
+        static inline v8f fmadd(v8f a, v8f b, v8f c)
+        {
+            for (int i = 0; i < 8; i++) c.v[i] += a.v[i] * b.v[i];
+            return c;
+        }
+        static inline v8f exp(v8f a)
+        {
+            for (int i = 0; i < 8; i++) a.v[i] = std::exp(std::min(std::max(a.v[i], -87.33f), 88.37f));
+            return a;
+        }
+        static inline void deinterleave(v8f a, v8f b, v8f &even, v8f &odd)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                even.v[i]     = a.v[2 * i];
+                odd.v[i]      = a.v[2 * i + 1];
+                even.v[i + 4] = b.v[2 * i];
+                odd.v[i + 4]  = b.v[2 * i + 1];
+            }
+        }
+        static inline v8f loadFp16(const uint16_t *p)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = Half::widen(p[i], Half::FP16);
+            return r;
+        }
+        static inline v8f loadBf16(const uint16_t *p)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = Half::widen(p[i], Half::BF16);
+            return r;
+        }
+        static inline v8f loadU8(const uint8_t *p)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = p[i];
+            return r;
+        }
+        template<int S>
+        static inline v8f loadStrided(const float *p)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = p[i * S];
+            return r;
+        }
+        static inline v8f loadPartial(const float *p, int n)
+        {
+            v8f r;
+            for (int i = 0; i < 8; i++) r.v[i] = (i < n) ? p[i] : 0.f;
+            return r;
+        }
+        static inline void storePartial(float *p, v8f a, int n)
+        {
+            for (int i = 0; i < n; i++) p[i] = a.v[i];
+        }
+        static inline void prefetch(const float *p)
+        {
+#if defined(__GNUC__)
+            __builtin_prefetch(p);
+#else
+            (void)p;
+#endif
+        }
+        static inline float hsum(v8f a)
+        {
+            float s = 0.f;
+            for (int i = 0; i < 8; i++) s += a.v[i];
+            return s;
+        }
+        static inline float hmax(v8f a)
+        {
+            float m = a.v[0];
+            for (int i = 1; i < 8; i++) m = (a.v[i] > m) ? a.v[i] : m;
+            return m;
+        }
+        static inline int greater(v8f a, v8f b)
+        {
+            int m = 0;
+            for (int i = 0; i < 8; i++) m |= (a.v[i] > b.v[i]) << i;
+            return m;
+        }
+#endif
+
+        // Storage formats of weights with their loads widened to float, for
+        // kernels templated on the format (see Half).
+        struct Fp32
+        {
+            typedef float type;
+            static inline v8f load(const float *p)      { return simd::load(p); }
+        };
+        struct Fp16
+        {
+            typedef uint16_t type;
+            static inline v8f load(const uint16_t *p)   { return loadFp16(p); }
+        };
+        struct Bf16
+        {
+            typedef uint16_t type;
+            static inline v8f load(const uint16_t *p)   { return loadBf16(p); }
+        };
+    }
+    }
+}
+
+#endif
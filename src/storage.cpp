@@ -65,6 +65,23 @@ void cnn:: saveNet(const string &filename, cnn::CNN &net, bool binary)
         fs.release();
     }
 };
+bool cnn::loadTuning(const string &filename, cnn::Tuning &tuning)
+{
+    FileStorage fs;
+    if (!fs.open(filename, FileStorage::READ))
+        return false;
+    tuning.read(fs["tuning"]);
+    fs.release();
+    return true;
+}
+void cnn::saveTuning(const string &filename, const cnn::Tuning &tuning)
+{
+    FileStorage fs(filename, FileStorage::WRITE);
+    fs << "tuning";
+    tuning.write(fs);
+    fs.release();
+}
+
 void cnn::readMats(size_t amount, size_t rows, size_t cols, size_t depth, ifstream &f, vector<Mat> &mats)
 {
     vector<float> buffer(amount*depth*rows*cols);
@@ -50,6 +50,10 @@ namespace cnn
 {
     void loadNet(const string &filename, cnn::CNN &net, bool binary = BINARY);
     void saveNet(const string &filename, cnn::CNN &net, bool binary = BINARY);
+    // Tuning files (see CNN::tune); loadTuning returns false when the file
+    // cannot be opened.
+    bool loadTuning(const string &filename, cnn::Tuning &tuning);
+    void saveTuning(const string &filename, const cnn::Tuning &tuning);
     void readMats(size_t amount, size_t rows, size_t cols, size_t depth, ifstream &f, vector<Mat> &mats);
     void readVector(size_t amount, ifstream &f, vector<float> &vector);
     void createCNNLayer(cnn::CNNLayer &layer, const string &type, const CNNParam &params,  ifstream *file = nullptr);
@@ -0,0 +1,167 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include <cstring>
+#include "tensor.h"
+
+using namespace cnn;
+
+void Tensor::create(int channels, int rows, int cols)
+{
+    if (!empty() && _channels == channels && _rows == rows && _cols == cols)
+        return;
+
+    const int lanes   = std::min<int>(channels, BLOCK);
+    const size_t step = alignSize(static_cast<size_t>(rows) * cols * lanes, ALIGN / sizeof(float));
+    const int nBlocks = (channels + BLOCK - 1) / BLOCK;
+
+    _buffer.create(1, static_cast<int>(step * nBlocks + ALIGN / sizeof(float)), CV_32F);
+    _data      = alignPtr(_buffer.ptr<float>(), ALIGN);
+    _channels  = channels;
+    _rows      = rows;
+    _cols      = cols;
+    _lanes     = lanes;
+    _blockStep = step;
+}
+
+void Tensor::create(int channels, int rows, int cols, void *data)
+{
+    CV_Assert(reinterpret_cast<size_t>(data) % ALIGN == 0);
+    _buffer.release();
+    _data      = static_cast<float*>(data);
+    _channels  = channels;
+    _rows      = rows;
+    _cols      = cols;
+    _lanes     = std::min<int>(channels, BLOCK);
+    _blockStep = alignSize(static_cast<size_t>(rows) * cols * _lanes, ALIGN / sizeof(float));
+}
+
+size_t Tensor::bytes(int channels, int rows, int cols)
+{
+    const int lanes   = std::min<int>(channels, BLOCK);
+    const size_t step = alignSize(static_cast<size_t>(rows) * cols * lanes, ALIGN / sizeof(float));
+    return step * ((channels + BLOCK - 1) / BLOCK) * sizeof(float);
+}
+
+void Tensor::release()
+{
+    *this = Tensor();
+}
+
+Tensor Tensor::rowRange(int r0, int r1) const
+{
+    CV_Assert(0 <= r0 && r0 <= r1 && r1 <= _rows);
+    Tensor view(*this);
+    view._rows = r1 - r0;
+    view._data = _data + r0 * rowStep();
+    return view;
+}
+
+void Tensor::pad(Tensor &output, int padW, int padH) const
+{
+    output.create(_channels, _rows + 2 * padH, _cols + 2 * padW);
+    const size_t left  = static_cast<size_t>(padW) * _lanes;
+    const size_t width = rowStep();
+    for (int b = 0; b < blocks(); b++)
+    {
+        for (int y = 0; y < padH; y++)
+        {
+            memset(output.ptr(b, y), 0, output.rowStep() * sizeof(float));
+            memset(output.ptr(b, output.rows() - 1 - y), 0, output.rowStep() * sizeof(float));
+        }
+        for (int y = 0; y < _rows; y++)
+        {
+            float *dst = output.ptr(b, y + padH);
+            memset(dst, 0, left * sizeof(float));
+            memcpy(dst + left, ptr(b, y), width * sizeof(float));
+            memset(dst + left + width, 0, left * sizeof(float));
+        }
+    }
+}
+
+void Tensor::fromMat(const Mat &image)
+{
+    CV_Assert(image.channels() <= BLOCK);
+    Mat _image = image;
+    if (image.depth() != CV_32F)
+        image.convertTo(_image, CV_32F);
+
+    create(_image.channels(), _image.rows, _image.cols);
+    for (int y = 0; y < _rows; y++)
+        memcpy(ptr(0, y), _image.ptr<float>(y), rowStep() * sizeof(float));
+}
+
+void Tensor::fromPlanes(const vector<Mat> &planes)
+{
+    create(static_cast<int>(planes.size()), planes[0].rows, planes[0].cols);
+    for (int b = 0; b < blocks(); b++)
+        for (int y = 0; y < _rows; y++)
+        {
+            float *dst = ptr(b, y);
+            for (int l = 0; l < _lanes; l++)
+            {
+                const int c = b * BLOCK + l;
+                if (c < _channels)
+                {
+                    const float *src = planes[c].ptr<float>(y);
+                    for (int x = 0; x < _cols; x++)
+                        dst[x * _lanes + l] = src[x];
+                }
+                else
+                {
+                    for (int x = 0; x < _cols; x++)
+                        dst[x * _lanes + l] = 0.f;
+                }
+            }
+        }
+}
+
+void Tensor::toPlanes(vector<Mat> &planes) const
+{
+    Mat _planes(_channels, _rows * _cols, CV_32F);
+    for (int c = 0; c < _channels; c++)
+    {
+        float *dst = _planes.ptr<float>(c);
+        for (int y = 0; y < _rows; y++)
+        {
+            const float *src = ptr(c / BLOCK, y) + c % BLOCK;
+            for (int x = 0; x < _cols; x++)
+                dst[y * _cols + x] = src[x * _lanes];
+        }
+    }
+
+    planes.resize(_channels);
+    for (int c = 0; c < _channels; c++)
+        planes[c] = _planes.row(c).reshape(1, _rows);
+}
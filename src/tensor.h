@@ -0,0 +1,128 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __tensor__
+#define __tensor__
+
+#include "opencv2/opencv.hpp"
+#include "arena.h"
+
+using namespace cv;
+using namespace std;
+
+namespace cnn
+{
+    // Activations of one image in channel-blocked (NCHWc) layout. Channels are
+    // grouped in blocks of BLOCK that are interleaved per pixel, so block b holds
+    // rows x cols pixels of lanes() consecutive floats:
+    //
+    //     ptr(b, y)[x * lanes() + l] = channel b * BLOCK + l at (x, y)
+    //
+    // Blocks live in one 64-byte aligned allocation. Tensors narrower than a
+    // block (the image and the two-class score maps) use as many lanes as they
+    // have channels, which is also the layout of an interleaved cv::Mat.
+    // The unused lanes of a partial last block are kept at zero by every Op,
+    // so kernels may read and compute whole blocks.
+    //
+    // Like cv::Mat, copies share the data and create() only reallocates when
+    // the shape changes.
+    class Tensor
+    {
+    public:
+        enum
+        {
+            BLOCK = 8,      // channels per block, one SIMD register of floats
+            ALIGN = 64      // byte alignment of every block
+        };
+
+        Tensor(): _channels(0), _rows(0), _cols(0), _lanes(0), _blockStep(0), _data(nullptr) {}
+        Tensor(int channels, int rows, int cols): Tensor() { create(channels, rows, cols); }
+
+        void create(int channels, int rows, int cols);
+        // Same, on bytes(channels, rows, cols) bytes of memory owned by the
+        // caller, 64-byte aligned.
+        void create(int channels, int rows, int cols, void *data);
+        void create(int channels, int rows, int cols, Arena &arena)
+        {
+            create(channels, rows, cols, arena.allocate(bytes(channels, rows, cols)));
+        }
+        void release();
+
+        static size_t bytes(int channels, int rows, int cols);
+
+        bool   empty() const     { return _data == nullptr; }
+        int    channels() const  { return _channels; }
+        int    rows() const      { return _rows; }
+        int    cols() const      { return _cols; }
+        Size   size() const      { return Size(_cols, _rows); }
+        int    lanes() const     { return _lanes; }
+        int    blocks() const    { return (_channels + BLOCK - 1) / BLOCK; }
+        // Floats between two blocks and between two rows of a block.
+        size_t blockStep() const { return _blockStep; }
+        size_t rowStep() const   { return static_cast<size_t>(_cols) * _lanes; }
+
+        float *ptr(int block = 0, int row = 0)
+        {
+            return _data + block * _blockStep + row * rowStep();
+        }
+        const float *ptr(int block = 0, int row = 0) const
+        {
+            return _data + block * _blockStep + row * rowStep();
+        }
+
+        // Rows [r0, r1) of every block, sharing the data.
+        Tensor rowRange(int r0, int r1) const;
+
+        // Copy with a zero border of padW columns and padH rows.
+        void pad(Tensor &output, int padW, int padH) const;
+
+        // Conversions at the API boundary: an interleaved image of up to
+        // BLOCK channels (converted to float), or one plane per channel.
+        void fromMat(const Mat &image);
+        void fromPlanes(const vector<Mat> &planes);
+        // Planes are views of one channels x (rows * cols) matrix.
+        void toPlanes(vector<Mat> &planes) const;
+
+    private:
+        int    _channels;
+        int    _rows;
+        int    _cols;
+        int    _lanes;
+        size_t _blockStep;
+        Mat    _buffer;
+        float *_data;
+    };
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include "tune.h"
+#include "cnn.h"
+
+using namespace cnn;
+
+bool Tuning::Key::operator<(const Key &other) const
+{
+    if (layer != other.layer)       return layer < other.layer;
+    if (outputs != other.outputs)   return outputs < other.outputs;
+    if (channels != other.channels) return channels < other.channels;
+    if (rows != other.rows)         return rows < other.rows;
+    if (cols != other.cols)         return cols < other.cols;
+    if (threads != other.threads)   return threads < other.threads;
+    return isa < other.isa;
+}
+
+int Tuning::find(const Key &key) const
+{
+    map<Key, Entry>::const_iterator it = _entries.find(key);
+    return (it != _entries.end()) ? it->second.algorithm : static_cast<int>(CNNConvAlgo::AUTO);
+}
+
+void Tuning::set(const Key &key, int algorithm, double ms)
+{
+    Entry &entry    = _entries[key];
+    entry.algorithm = algorithm;
+    entry.ms        = ms;
+}
+
+void Tuning::write(FileStorage &fs) const
+{
+    fs << "[";
+    for (map<Key, Entry>::const_iterator it = _entries.begin(); it != _entries.end(); it++)
+    {
+        fs << "{";
+        fs << "layer"     << it->first.layer;
+        fs << "outputs"   << it->first.outputs;
+        fs << "channels"  << it->first.channels;
+        fs << "rows"      << it->first.rows;
+        fs << "cols"      << it->first.cols;
+        fs << "threads"   << it->first.threads;
+        fs << "isa"       << it->first.isa;
+        fs << "algorithm" << it->second.algorithm;
+        fs << "ms"        << it->second.ms;
+        fs << "}";
+    }
+    fs << "]";
+}
+
+void Tuning::read(const FileNode &node)
+{
+    _entries.clear();
+    if (node.type() != FileNode::SEQ)
+        return;
+    for (FileNodeIterator it = node.begin(); it != node.end(); it++)
+    {
+        const FileNode entry = *it;
+        Key key;
+        key.layer    = (string)entry["layer"];
+        key.outputs  = (int)entry["outputs"];
+        key.channels = (int)entry["channels"];
+        key.rows     = (int)entry["rows"];
+        key.cols     = (int)entry["cols"];
+        key.threads  = (int)entry["threads"];
+        key.isa      = (string)entry["isa"];
+        set(key, (int)entry["algorithm"], (double)entry["ms"]);
+    }
+}
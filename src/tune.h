@@ -0,0 +1,86 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __tune__
+#define __tune__
+
+#include <map>
+#include "opencv2/opencv.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace cnn
+{
+    // Engines measured fastest by CNN::tune for CONV and FC layers left on
+    // CNNConvAlgo::AUTO, per input shape, thread count and ISA level (Isa),
+    // so that a machine tuned once picks them at plan time without trial
+    // runs. One Tuning may hold the entries of several nets and machines;
+    // it is read and written with loadTuning / saveTuning (storage.h).
+    class Tuning
+    {
+    public:
+        struct Key
+        {
+            string layer;       // CNNLayer name, which includes the net name
+            int    outputs;     // outputs of the step (a folded head has one)
+            int    channels;    // input shape
+            int    rows;
+            int    cols;
+            int    threads;
+            string isa;         // Isa::name
+
+            bool operator<(const Key &other) const;
+        };
+
+        struct Entry
+        {
+            int    algorithm;   // CNNConvAlgo
+            double ms;          // time of the pass it was measured on
+        };
+
+        // Algorithm recorded for key, or CNNConvAlgo::AUTO.
+        int find(const Key &key) const;
+        void set(const Key &key, int algorithm, double ms);
+        size_t size() const { return _entries.size(); }
+
+        void write(FileStorage &fs) const;
+        void read(const FileNode &node);
+
+    private:
+        map<Key, Entry> _entries;
+    };
+}
+
+#endif
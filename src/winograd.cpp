@@ -0,0 +1,212 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#include "winograd.h"
+#include "isa.h"
+#include "simd.h"
+
+using namespace cnn;
+using namespace cnn::simd;
+
+namespace
+{
+    // F(2x2, 3x3) (Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks")
+    const float G2[4][3]  = {{ 1.0f,  0.0f, 0.0f},
+                             { 0.5f,  0.5f, 0.5f},
+                             { 0.5f, -0.5f, 0.5f},
+                             { 0.0f,  0.0f, 1.0f}};
+
+    // F(4x4, 3x3)
+    const float G4[6][3]  = {{ 1.f / 4.f,   0.0f,        0.0f     },
+                             {-1.f / 6.f,  -1.f / 6.f,  -1.f / 6.f},
+                             {-1.f / 6.f,   1.f / 6.f,  -1.f / 6.f},
+                             { 1.f / 24.f,  1.f / 12.f,  1.f / 6.f},
+                             { 1.f / 24.f, -1.f / 12.f,  1.f / 6.f},
+                             { 0.0f,        0.0f,        1.0f     }};
+
+    template<int M>
+    struct Matrices;
+
+    template<>
+    struct Matrices<2>
+    {
+        static const float (&G())[4][3] { return G2; }
+    };
+
+    template<>
+    struct Matrices<4>
+    {
+        static const float (&G())[6][3] { return G4; }
+    };
+
+    template<int M>
+    void kernelTile(const float *g, float *u, size_t stride)
+    {
+        const int A = M + 2;
+        const float (&G)[A][3] = Matrices<M>::G();
+        float tmp[A][3];
+        for (int i = 0; i < A; i++)
+            for (int j = 0; j < 3; j++)
+                tmp[i][j] = G[i][0] * g[j] + G[i][1] * g[3 + j] + G[i][2] * g[6 + j];
+        for (int i = 0; i < A; i++)
+            for (int j = 0; j < A; j++)
+                u[(i * A + j) * stride] = tmp[i][0] * G[j][0] + tmp[i][1] * G[j][1] + tmp[i][2] * G[j][2];
+    }
+
+    // One dimensional B^T and A^T transforms on 8 channels at a time,
+    // written out so the zeros and the shared terms of the matrices above
+    // cost nothing.
+    inline void inputRow2(const v8f *d, int ds, v8f *t, int ts)
+    {
+        t[0]      = sub(d[0], d[2 * ds]);
+        t[ts]     = add(d[ds], d[2 * ds]);
+        t[2 * ts] = sub(d[2 * ds], d[ds]);
+        t[3 * ts] = sub(d[ds], d[3 * ds]);
+    }
+
+    inline void inputRow4(const v8f *d, int ds, v8f *t, int ts)
+    {
+        const v8f d0 = d[0], d1 = d[ds], d2 = d[2 * ds], d3 = d[3 * ds], d4 = d[4 * ds], d5 = d[5 * ds];
+        const v8f a  = fmadd(set1(-4.f), d2, d4);
+        const v8f b  = fmadd(set1(-4.f), d1, d3);
+        const v8f c  = sub(d4, d2);
+        const v8f e  = mul(set1(2.f), sub(d3, d1));
+        t[0]      = fmadd(set1(4.f), d0, fmadd(set1(-5.f), d2, d4));
+        t[ts]     = add(a, b);
+        t[2 * ts] = sub(a, b);
+        t[3 * ts] = add(c, e);
+        t[4 * ts] = sub(c, e);
+        t[5 * ts] = fmadd(set1(4.f), d1, fmadd(set1(-5.f), d3, d5));
+    }
+
+    inline void outputRow2(const v8f *m, int ms, v8f *y, int ys)
+    {
+        y[0]  = add(add(m[0], m[ms]), m[2 * ms]);
+        y[ys] = sub(sub(m[ms], m[2 * ms]), m[3 * ms]);
+    }
+
+    inline void outputRow4(const v8f *m, int ms, v8f *y, int ys)
+    {
+        const v8f a = add(m[ms], m[2 * ms]);
+        const v8f b = sub(m[ms], m[2 * ms]);
+        const v8f c = add(m[3 * ms], m[4 * ms]);
+        const v8f d = sub(m[3 * ms], m[4 * ms]);
+        y[0]      = add(add(m[0], a), c);
+        y[ys]     = fmadd(set1(2.f), d, b);
+        y[2 * ys] = fmadd(set1(4.f), c, a);
+        y[3 * ys] = add(fmadd(set1(8.f), d, b), m[5 * ms]);
+    }
+
+    template<int M>
+    void inputTile(const float *d, size_t ds, float *v, size_t stride)
+    {
+        const int A = M + 2;
+        v8f in[A * A], tmp[A * A];
+        for (int i = 0; i < A; i++)
+            for (int j = 0; j < A; j++)
+                in[i * A + j] = load(d + i * ds + j * 8);
+        // Columns first (B^T d), then rows ((B^T d) B).
+        for (int j = 0; j < A; j++)
+            (M == 4) ? inputRow4(in + j, A, tmp + j, A) : inputRow2(in + j, A, tmp + j, A);
+        for (int i = 0; i < A; i++)
+            (M == 4) ? inputRow4(tmp + i * A, 1, in + i * A, 1) : inputRow2(tmp + i * A, 1, in + i * A, 1);
+        for (int e = 0; e < A * A; e++)
+            store(v + e * stride, in[e]);
+    }
+
+    template<int M>
+    void outputTile(const float *mm, size_t stride, float *y)
+    {
+        const int A = M + 2;
+        v8f in[A * A], tmp[M * A], out[M * M];
+        for (int e = 0; e < A * A; e++)
+            in[e] = load(mm + e * stride);
+        for (int j = 0; j < A; j++)
+            (M == 4) ? outputRow4(in + j, A, tmp + j, A) : outputRow2(in + j, A, tmp + j, A);
+        for (int i = 0; i < M; i++)
+            (M == 4) ? outputRow4(tmp + i * A, 1, out + i * M, 1) : outputRow2(tmp + i * A, 1, out + i * M, 1);
+        for (int e = 0; e < M * M; e++)
+            store(y + e * 8, out[e]);
+    }
+
+    void transformInput(int m, const float *d, size_t ds, float *v, size_t stride)
+    {
+        if (m == 4)
+            inputTile<4>(d, ds, v, stride);
+        else
+            inputTile<2>(d, ds, v, stride);
+    }
+
+    void transformOutput(int m, const float *mm, size_t stride, float *y)
+    {
+        if (m == 4)
+            outputTile<4>(mm, stride, y);
+        else
+            outputTile<2>(mm, stride, y);
+    }
+}
+
+namespace cnn
+{
+    namespace CNN_ISA
+    {
+        void bindWinograd(Kernels &kernels)
+        {
+            kernels.transformInput  = transformInput;
+            kernels.transformOutput = transformOutput;
+        }
+    }
+}
+
+#ifdef CNN_ISA_BASELINE
+
+void Winograd::transformKernel(int m, const float *g, float *u, size_t stride)
+{
+    if (m == 4)
+        kernelTile<4>(g, u, stride);
+    else
+        kernelTile<2>(g, u, stride);
+}
+
+void Winograd::transformInput(int m, const float *d, size_t ds, float *v, size_t stride)
+{
+    Isa::kernels().transformInput(m, d, ds, v, stride);
+}
+
+void Winograd::transformOutput(int m, const float *mm, size_t stride, float *y)
+{
+    Isa::kernels().transformOutput(m, mm, stride, y);
+}
+
+#endif
@@ -0,0 +1,79 @@
+/**************************************************************************************************
+ **************************************************************************************************
+ 
+ BSD 3-Clause License (https://www.tldrlegal.com/l/bsd3)
+ 
+ Copyright (c) 2016 Andrés Solís Montero <http://www.solism.ca>, All rights reserved.
+ 
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 3. Neither the name of the copyright holder nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ **************************************************************************************************
+ **************************************************************************************************/
+
+#ifndef __winograd__
+#define __winograd__
+
+#include <cstddef>
+
+namespace cnn
+{
+    // Winograd minimal filtering F(m x m, 3 x 3) for stride 1, 3x3 layers.
+    // Each m x m output tile is computed from an (m+2) x (m+2) input tile
+    // with (m+2)^2 multiplies per input/output channel pair instead of 9 m^2,
+    // i.e. 2.25x fewer for F(2x2,3x3) and 4x fewer for F(4x4,3x3).
+    //
+    // Input and output tiles are transformed 8 channels at a time, straight
+    // from and to channel-blocked tensors. The element-wise products of all
+    // tiles are then, per transformed element, a 1x1 convolution from kernelD
+    // to nLayers channels over the tiles.
+    class Winograd
+    {
+    public:
+        static bool applicable(int kernelW, int kernelH, int strideW, int strideH)
+        {
+            return kernelW == 3 && kernelH == 3 && strideW == 1 && strideH == 1;
+        }
+
+        static int alpha(int m)
+        {
+            return m + 2;
+        }
+
+        // U = G g G^T for a 3x3 kernel g. Element e of U is written to u[e * stride].
+        static void transformKernel(int m, const float *g, float *u, size_t stride);
+
+        // V = B^T d B for an alpha x alpha tile d of 8-channel pixels, 8 floats
+        // apart within a row and ds floats apart between rows. Element e of V
+        // (8 channels) is written to v + e * stride.
+        static void transformInput(int m, const float *d, size_t ds, float *v, size_t stride);
+
+        // Y = A^T M A for an alpha x alpha tile of products, element e of M
+        // (8 channels) read from mm + e * stride. Y is m x m pixels of 8
+        // channels, row-major.
+        static void transformOutput(int m, const float *mm, size_t stride, float *y);
+    };
+}
+
+#endif